@@ -10,8 +10,12 @@
 
 #ifdef __KERNEL__
 #include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/errno.h>
 #else
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
 #endif
 
 #include "aesd-circular-buffer.h"
@@ -29,56 +33,107 @@
 struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn )
 {
-    // get the current out_offs location
-    uint8_t out_offs = buffer->out_offs;
+    // sampled once, a lockless caller may see the count change under it
+    uint32_t out_offs = buffer->out_offs;
+    uint32_t low = 0;
+    uint32_t high = buffer->in_offs - out_offs;
+    uint32_t mid;
+    struct aesd_buffer_entry *entry;
 
-    // while char_offset is greater than size of the current entry
-    // reduce offset by size of current entry
-    // advance the out_offs location
-    while(char_offset >= buffer->entry[out_offs].size)
+    if((high == 0) || (high > buffer->mask + 1) || (char_offset >= aesd_circular_buffer_size(buffer)))
     {
-        char_offset -= buffer->entry[out_offs].size;
+        // offset is past the last byte, no data found
+        return NULL;
+    }
 
-        // advance the out_offs location
-        if(out_offs == (AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - 1))
+    // binary search for the last entry starting at or before char_offset,
+    // entry file offsets increase from the oldest entry. The slots are read
+    // directly, so a torn search gives a wrong entry for the caller to retry
+    // rather than a NULL one
+    while((high - low) > 1)
+    {
+        mid = low + ((high - low) / 2);
+        entry = &buffer->entry[(out_offs + mid) & buffer->mask];
+        if(aesd_circular_buffer_entry_fpos(buffer, entry) <= char_offset)
         {
-            out_offs = 0;
+            low = mid;
         }
         else
         {
-            out_offs++;
+            high = mid;
         }
-        
-        // check if offset exceeds last byte
-        if(out_offs == buffer->in_offs)
+    }
+
+    entry = &buffer->entry[(out_offs + low) & buffer->mask];
+
+    // store byte of the returned aesd_buffer_entry->buffptr member
+    // corresponding to char_offset, which a torn search may not hold
+    *entry_offset_byte_rtn = char_offset - aesd_circular_buffer_entry_fpos(buffer, entry);
+    if(*entry_offset_byte_rtn >= entry->size)
+    {
+        return NULL;
+    }
+    return entry;
+}
+
+/**
+* @param buffer the buffer to search, its entries added in timestamp order.  Any necessary locking must be
+*      performed by caller, a lockless caller must retry if the buffer changed meanwhile.
+* @param timestamp the time to search for, in the clock of the entries' timestamp
+* @return the number of entries written before the oldest entry with a timestamp at or after timestamp,
+*      counting from the oldest entry, or the number of entries if every one is older.
+*/
+uint32_t aesd_circular_buffer_find_entry_for_time(struct aesd_circular_buffer *buffer,
+            uint64_t timestamp)
+{
+    uint32_t low = 0;
+    uint32_t high = aesd_circular_buffer_count(buffer);
+    uint32_t mid;
+
+    // binary search for the first entry at or after timestamp, reading the slots
+    // directly since the count may shrink under a lockless caller
+    while(low < high)
+    {
+        mid = low + ((high - low) / 2);
+        if(buffer->entry[(buffer->out_offs + mid) & buffer->mask].timestamp < timestamp)
         {
-            if(char_offset <= 0)
-            {
-                return NULL;
-            }
+            low = mid + 1;
         }
-
-        // if entry doesn't exist
-        // return NULL for no data found
-        if(buffer->entry[out_offs].buffptr == NULL)
+        else
         {
-            return NULL;
+            high = mid;
         }
     }
-    
-    // if entry doesn't exist
-    // return NULL for no data found
-    if(buffer->entry[out_offs].buffptr == NULL)
+    return low;
+}
+
+/**
+* Removes the oldest entry of @param buffer, clearing its slot since the capacity
+* may be smaller than the number of slots.
+* Any necessary locking must be performed by caller.
+* @return the buffptr of the removed entry, for the caller to free, or NULL if
+* the buffer was empty
+*/
+const char *aesd_circular_buffer_remove_oldest(struct aesd_circular_buffer *buffer)
+{
+    const char *ret_buffptr;
+    struct aesd_buffer_entry *oldest;
+
+    if(aesd_circular_buffer_count(buffer) == 0)
     {
         return NULL;
     }
 
-    // store byte of the returned aesd_buffer_entry->buffptr member
-    // corresponding to char_offset.
-    *entry_offset_byte_rtn = char_offset;
+    oldest = &buffer->entry[buffer->out_offs & buffer->mask];
+    ret_buffptr = oldest->buffptr;
+    buffer->base_offs += oldest->size;
+    buffer->generation++;
+    oldest->buffptr = NULL;
+    oldest->size = 0;
+    buffer->out_offs++;
+    buffer->full = false;
 
-    // return buffer entry
-    return &(buffer->entry[out_offs]);
+    return ret_buffptr;
 }
 
 /**
@@ -87,56 +142,177 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct
 * new start location.
 * Any necessary locking must be handled by the caller
 * Any memory referenced in @param add_entry must be allocated by and/or must have a lifetime managed by the caller.
+* @return the buffptr of the overwritten entry, which the caller should free, or NULL
 */
 const char * aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry)
 {
     const char* ret_buffptr = NULL;
-    
-    // when buffer is not full
-    if(buffer->full == false)
+
+    // when buffer is full drop the oldest entry
+    if(buffer->full)
     {
-        // store buffer entry
-        buffer->entry[buffer->in_offs].buffptr = add_entry->buffptr;
-        buffer->entry[buffer->in_offs].size = add_entry->size;
+        ret_buffptr = aesd_circular_buffer_remove_oldest(buffer);
+    }
+
+    // store buffer entry, entries keep their start so eviction only moves base_offs
+    buffer->entry[buffer->in_offs & buffer->mask] = *add_entry;
+    buffer->entry[buffer->in_offs & buffer->mask].start = buffer->end_offs;
+    buffer->end_offs += add_entry->size;
+    buffer->in_offs++;
+
+    // check and set if buffer is full
+    buffer->full = (aesd_circular_buffer_count(buffer) == buffer->capacity);
+
+    return ret_buffptr;
+}
+
+/**
+* Copies up to @param count bytes across consecutive entries of @param buffer, starting
+* @param entry_offset bytes into the entry at free running index @param index, which must lie
+* between out_offs and in_offs. Any necessary locking must be performed by caller.
+* @param copy is called once per entry, the copy stops early if it copies fewer bytes than asked.
+* On return index and entry_offset describe the first byte not copied, an entry that was copied
+* to its end leaves them at the start of the next entry.
+* @return the number of bytes copied
+*/
+size_t aesd_circular_buffer_copy_from(struct aesd_circular_buffer *buffer, uint32_t *index,
+            size_t *entry_offset, size_t count, aesd_circular_buffer_copy_fn copy, void *ctx)
+{
+    size_t copied = 0;
+    size_t bytes;
+    size_t done;
+    struct aesd_buffer_entry *entry;
 
-        // check if in_offs location has reached end of buffer
-        if(buffer->in_offs == (AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - 1))
+    while((copied < count) && (*index != buffer->in_offs))
+    {
+        entry = &buffer->entry[*index & buffer->mask];
+        if((entry->buffptr == NULL) || (*entry_offset >= entry->size))
         {
-            // go back to start of buffer
-            buffer->in_offs = 0;
+            // a slot emptied under a lockless caller, which retries
+            break;
         }
-        else
+        bytes = entry->size - *entry_offset;
+        if(bytes > (count - copied))
         {
-            // increment in_offs location
-            buffer->in_offs++;
+            bytes = count - copied;
         }
 
-        // check and set if buffer is full
-        if(buffer->in_offs == buffer->out_offs)
+        done = copy(ctx, copied, entry->buffptr + *entry_offset, bytes);
+        copied += done;
+        *entry_offset += done;
+        if(*entry_offset == entry->size)
         {
-            buffer->full = true;
+            (*index)++;
+            *entry_offset = 0;
+        }
+
+        if(done < bytes)
+        {
+            break;
         }
     }
-    // when buffer is full
-    else if(buffer->full == true)
+
+    return copied;
+}
+
+static size_t copy_to_memory(void *ctx, size_t dest_offset, const char *src, size_t bytes)
+{
+    memcpy((char *)ctx + dest_offset, src, bytes);
+    return bytes;
+}
+
+/**
+* Copies up to @param count bytes starting at @param char_offset, the zero referenced character
+* index if all buffer strings were concatenated end to end, into @param dest.
+* Any necessary locking must be performed by caller.
+* @return the number of bytes copied, less than count only when the buffer ends first
+*/
+size_t aesd_circular_buffer_copy_range(struct aesd_circular_buffer *buffer, size_t char_offset,
+            char *dest, size_t count)
+{
+    uint32_t index;
+    size_t entry_offset;
+    struct aesd_buffer_entry *entry;
+
+    entry = aesd_circular_buffer_find_entry_offset_for_fpos(buffer, char_offset, &entry_offset);
+    if(entry == NULL)
     {
-        ret_buffptr = buffer->entry[buffer->in_offs].buffptr;
-        // store buffer entry
-        buffer->entry[buffer->in_offs].buffptr = add_entry->buffptr;
-        buffer->entry[buffer->in_offs].size = add_entry->size;
-
-        // increment in_offs and out_offs location
-        buffer->in_offs++;
-        buffer->out_offs++;
+        return 0;
     }
-    
-    return ret_buffptr;
+
+    index = aesd_circular_buffer_entry_index(buffer, entry);
+    return aesd_circular_buffer_copy_from(buffer, &index, &entry_offset, count, copy_to_memory, dest);
 }
 
 /**
 * Initializes the circular buffer described by @param buffer to an empty struct
+* holding AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries
 */
 void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
 {
     memset(buffer,0,sizeof(struct aesd_circular_buffer));
+    buffer->entry = buffer->default_entry;
+    buffer->mask = AESDCHAR_DEFAULT_ENTRY_SLOTS - 1;
+    buffer->capacity = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+/**
+* Initializes @param buffer to hold @param capacity entries, rounded up to a power of two
+* @return 0 on success, -EINVAL if capacity is 0 or above AESDCHAR_MAX_ENTRY_SLOTS,
+* -ENOMEM if the slots could not be allocated
+*/
+int aesd_circular_buffer_init_capacity(struct aesd_circular_buffer *buffer, uint32_t capacity)
+{
+    uint32_t slots = 1;
+    struct aesd_buffer_entry *entry;
+
+    if((capacity == 0) || (capacity > AESDCHAR_MAX_ENTRY_SLOTS))
+    {
+        return -EINVAL;
+    }
+
+    while(slots < capacity)
+    {
+        slots <<= 1;
+    }
+
+    aesd_circular_buffer_init(buffer);
+    if(slots <= AESDCHAR_DEFAULT_ENTRY_SLOTS)
+    {
+        entry = buffer->default_entry;
+    }
+    else
+    {
+#ifdef __KERNEL__
+        entry = kvcalloc(slots, sizeof(struct aesd_buffer_entry), GFP_KERNEL);
+#else
+        entry = calloc(slots, sizeof(struct aesd_buffer_entry));
+#endif
+        if(entry == NULL)
+        {
+            return -ENOMEM;
+        }
+    }
+
+    buffer->entry = entry;
+    buffer->mask = slots - 1;
+    buffer->capacity = slots;
+    return 0;
+}
+
+/**
+* Releases slots allocated by aesd_circular_buffer_init_capacity(), the entry buffptrs
+* remain the caller's to free
+*/
+void aesd_circular_buffer_free(struct aesd_circular_buffer *buffer)
+{
+    if(buffer->entry != buffer->default_entry)
+    {
+#ifdef __KERNEL__
+        kvfree(buffer->entry);
+#else
+        free(buffer->entry);
+#endif
+    }
+    aesd_circular_buffer_init(buffer);
 }
@@ -16,7 +16,18 @@
 #include <stdbool.h>
 #endif
 
+/**
+ * Entries kept by a buffer set up with aesd_circular_buffer_init()
+ */
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
+/**
+ * Slots backing the default capacity, the power of two above it
+ */
+#define AESDCHAR_DEFAULT_ENTRY_SLOTS 16
+/**
+ * Largest capacity accepted by aesd_circular_buffer_init_capacity()
+ */
+#define AESDCHAR_MAX_ENTRY_SLOTS (1u << 20)
 
 struct aesd_buffer_entry
 {
@@ -28,44 +39,146 @@ struct aesd_buffer_entry
      * Number of bytes stored in buffptr
      */
     size_t size;
+    /**
+     * Bytes written to the buffer before this entry, set by aesd_circular_buffer_add_entry()
+     */
+    size_t start;
+    /**
+     * When the entry was committed, in ns of a clock that never goes back, so timestamps
+     * never decrease from the oldest entry. The driver uses CLOCK_MONOTONIC.
+     */
+    uint64_t timestamp;
 };
 
 struct aesd_circular_buffer
 {
     /**
-     * An array of pointers to memory allocated for the most recent write operations
+     * An array of pointers to memory allocated for the most recent write operations,
+     * mask + 1 slots long
+     */
+    struct aesd_buffer_entry *entry;
+    /**
+     * Number of slots minus one, the slot count is always a power of two
+     */
+    uint32_t mask;
+    /**
+     * Number of entries kept before the oldest one is overwritten
      */
-    struct aesd_buffer_entry  entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    uint32_t capacity;
     /**
-     * The current location in the entry structure where the next write should
-     * be stored.
+     * Free running count of entries added, the next write is stored in
+     * slot in_offs & mask
      */
-    uint8_t in_offs;
+    uint32_t in_offs;
     /**
-     * The first location in the entry structure to read from
+     * Free running index of the oldest entry, read from slot out_offs & mask
      */
-    uint8_t out_offs;
+    uint32_t out_offs;
     /**
      * set to true when the buffer entry structure is full
      */
     bool full;
+    /**
+     * Incremented whenever an entry is overwritten, which shifts the file offset of every other entry
+     */
+    uint32_t generation;
+    /**
+     * start of the oldest entry, subtracted from every start to get its file offset
+     */
+    size_t base_offs;
+    /**
+     * Bytes written to the buffer since init, the start of the next entry
+     */
+    size_t end_offs;
+    /**
+     * Slots used by aesd_circular_buffer_init(), so the default buffer needs no allocation
+     */
+    struct aesd_buffer_entry default_entry[AESDCHAR_DEFAULT_ENTRY_SLOTS];
 };
 
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn );
 
+extern uint32_t aesd_circular_buffer_find_entry_for_time(struct aesd_circular_buffer *buffer,
+            uint64_t timestamp);
+
 extern const char * aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry);
 
+extern const char *aesd_circular_buffer_remove_oldest(struct aesd_circular_buffer *buffer);
+
+/**
+ * Copies @param bytes from @param src to @param dest_offset bytes into the destination described by
+ * @param ctx, returning the number of bytes actually copied
+ */
+typedef size_t (*aesd_circular_buffer_copy_fn)(void *ctx, size_t dest_offset, const char *src, size_t bytes);
+
+extern size_t aesd_circular_buffer_copy_from(struct aesd_circular_buffer *buffer, uint32_t *index,
+            size_t *entry_offset, size_t count, aesd_circular_buffer_copy_fn copy, void *ctx);
+
+extern size_t aesd_circular_buffer_copy_range(struct aesd_circular_buffer *buffer, size_t char_offset,
+            char *dest, size_t count);
+
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
+extern int aesd_circular_buffer_init_capacity(struct aesd_circular_buffer *buffer, uint32_t capacity);
+
+extern void aesd_circular_buffer_free(struct aesd_circular_buffer *buffer);
+
+/**
+ * @return the number of entries currently stored in @param buffer
+ */
+static inline uint32_t aesd_circular_buffer_count(const struct aesd_circular_buffer *buffer)
+{
+    return buffer->in_offs - buffer->out_offs;
+}
+
+/**
+ * @return the number of bytes currently stored in @param buffer
+ */
+static inline size_t aesd_circular_buffer_size(const struct aesd_circular_buffer *buffer)
+{
+    return buffer->end_offs - buffer->base_offs;
+}
+
+/**
+ * @return the file offset of the first byte of @param entry, which must be stored in @param buffer
+ */
+static inline size_t aesd_circular_buffer_entry_fpos(const struct aesd_circular_buffer *buffer,
+            const struct aesd_buffer_entry *entry)
+{
+    return entry->start - buffer->base_offs;
+}
+
+/**
+ * @return the entry written @param n writes after the oldest one, or NULL if there is no such entry
+ */
+static inline struct aesd_buffer_entry *aesd_circular_buffer_entry_at(struct aesd_circular_buffer *buffer,
+            uint32_t n)
+{
+    if(n >= aesd_circular_buffer_count(buffer))
+    {
+        return NULL;
+    }
+    return &buffer->entry[(buffer->out_offs + n) & buffer->mask];
+}
+
+/**
+ * @return the free running index, between out_offs and in_offs, of @param entry stored in @param buffer
+ */
+static inline uint32_t aesd_circular_buffer_entry_index(const struct aesd_circular_buffer *buffer,
+            const struct aesd_buffer_entry *entry)
+{
+    return buffer->out_offs + (((uint32_t)(entry - buffer->entry) - buffer->out_offs) & buffer->mask);
+}
+
 /**
  * Create a for loop to iterate over each member of the circular buffer.
  * Useful when you've allocated memory for circular buffer entries and need to free it
  * @param entryptr is a struct aesd_buffer_entry* to set with the current entry
  * @param buffer is the struct aesd_buffer * describing the buffer
- * @param index is a uint8_t stack allocated value used by this macro for an index
+ * @param index is a uint32_t stack allocated value used by this macro for an index
  * Example usage:
- * uint8_t index;
+ * uint32_t index;
  * struct aesd_circular_buffer buffer;
  * struct aesd_buffer_entry *entry;
  * AESD_CIRCULAR_BUFFER_FOREACH(entry,&buffer,index) {
@@ -74,7 +187,7 @@ extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
  */
 #define AESD_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
     for(index=0, entryptr=&((buffer)->entry[index]); \
-            index<AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; \
+            index<=(buffer)->mask; \
             index++, entryptr=&((buffer)->entry[index]))
 
 
@@ -0,0 +1,197 @@
+/*
+ * aesd-trace.h
+ *
+ *  @brief Tracepoints of the aesdchar driver, in the aesdchar trace system
+ *
+ *  Each event names the device by minor number. Times are in ns, sizes and
+ *  offsets in bytes, entry indices count the entries written to the device
+ *  since module load like the batch write ioctl does, aesd_read has the low
+ *  32 bits of it. Disabled tracepoints cost a patched out branch.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM aesdchar
+
+#if !defined(_AESD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _AESD_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/**
+ * A read call that returned: where it started, what was asked and returned,
+ * the entry the file's cursor stopped in and how long it took
+ */
+TRACE_EVENT(aesd_read,
+    TP_PROTO(unsigned int minor, loff_t pos, size_t count, ssize_t ret, unsigned int entry, u64 ns),
+    TP_ARGS(minor, pos, count, ret, entry, ns),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(loff_t, pos)
+        __field(size_t, count)
+        __field(ssize_t, ret)
+        __field(unsigned int, entry)
+        __field(u64, ns)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->pos = pos;
+        __entry->count = count;
+        __entry->ret = ret;
+        __entry->entry = entry;
+        __entry->ns = ns;
+    ),
+    TP_printk("minor=%u pos=%lld count=%zu ret=%zd entry=%u ns=%llu",
+              __entry->minor, __entry->pos, __entry->count, __entry->ret,
+              __entry->entry, __entry->ns)
+);
+
+/**
+ * A write call that returned: what was asked and taken, the entries it
+ * committed, the bytes of a partial line left staged and how long it took
+ */
+TRACE_EVENT(aesd_write,
+    TP_PROTO(unsigned int minor, size_t count, ssize_t ret, unsigned int entries, size_t staged, u64 ns),
+    TP_ARGS(minor, count, ret, entries, staged, ns),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(size_t, count)
+        __field(ssize_t, ret)
+        __field(unsigned int, entries)
+        __field(size_t, staged)
+        __field(u64, ns)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->count = count;
+        __entry->ret = ret;
+        __entry->entries = entries;
+        __entry->staged = staged;
+        __entry->ns = ns;
+    ),
+    TP_printk("minor=%u count=%zu ret=%zd entries=%u staged=%zu ns=%llu",
+              __entry->minor, __entry->count, __entry->ret, __entry->entries,
+              __entry->staged, __entry->ns)
+);
+
+TRACE_EVENT(aesd_llseek,
+    TP_PROTO(unsigned int minor, loff_t off, int whence, loff_t size, loff_t ret),
+    TP_ARGS(minor, off, whence, size, ret),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(loff_t, off)
+        __field(int, whence)
+        __field(loff_t, size)
+        __field(loff_t, ret)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->off = off;
+        __entry->whence = whence;
+        __entry->size = size;
+        __entry->ret = ret;
+    ),
+    TP_printk("minor=%u off=%lld whence=%d size=%lld ret=%lld",
+              __entry->minor, __entry->off, __entry->whence, __entry->size, __entry->ret)
+);
+
+/**
+ * An AESDCHAR_IOCSEEKTO: the entry and offset asked for, the file
+ * position it resolved to and the result
+ */
+TRACE_EVENT(aesd_adjust_file_offset,
+    TP_PROTO(unsigned int minor, unsigned int write_cmd, unsigned int write_cmd_offset, loff_t pos, long ret),
+    TP_ARGS(minor, write_cmd, write_cmd_offset, pos, ret),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(unsigned int, write_cmd)
+        __field(unsigned int, write_cmd_offset)
+        __field(loff_t, pos)
+        __field(long, ret)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->write_cmd = write_cmd;
+        __entry->write_cmd_offset = write_cmd_offset;
+        __entry->pos = pos;
+        __entry->ret = ret;
+    ),
+    TP_printk("minor=%u write_cmd=%u write_cmd_offset=%u pos=%lld ret=%ld",
+              __entry->minor, __entry->write_cmd, __entry->write_cmd_offset,
+              __entry->pos, __entry->ret)
+);
+
+/**
+ * An AESDCHAR_IOCSEEKAFTER: the index or time asked for, the entry
+ * index and file position it resolved to and the result
+ */
+TRACE_EVENT(aesd_seek_after,
+    TP_PROTO(unsigned int minor, unsigned int by, u64 value, u64 index, loff_t pos, long ret),
+    TP_ARGS(minor, by, value, index, pos, ret),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(unsigned int, by)
+        __field(u64, value)
+        __field(u64, index)
+        __field(loff_t, pos)
+        __field(long, ret)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->by = by;
+        __entry->value = value;
+        __entry->index = index;
+        __entry->pos = pos;
+        __entry->ret = ret;
+    ),
+    TP_printk("minor=%u by=%u value=%llu index=%llu pos=%lld ret=%ld",
+              __entry->minor, __entry->by, __entry->value, __entry->index,
+              __entry->pos, __entry->ret)
+);
+
+/**
+ * An entry dropped from the buffer to make room for entry index
+ */
+TRACE_EVENT(aesd_overwrite,
+    TP_PROTO(unsigned int minor, u64 dropped, size_t size, u64 index),
+    TP_ARGS(minor, dropped, size, index),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(u64, dropped)
+        __field(size_t, size)
+        __field(u64, index)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->dropped = dropped;
+        __entry->size = size;
+        __entry->index = index;
+    ),
+    TP_printk("minor=%u dropped=%llu size=%zu index=%llu",
+              __entry->minor, __entry->dropped, __entry->size, __entry->index)
+);
+
+/**
+ * A contended acquisition of the device lock and how long it waited
+ */
+TRACE_EVENT(aesd_lock_wait,
+    TP_PROTO(unsigned int minor, u64 ns),
+    TP_ARGS(minor, ns),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(u64, ns)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->ns = ns;
+    ),
+    TP_printk("minor=%u ns=%llu", __entry->minor, __entry->ns)
+);
+
+#endif /* _AESD_TRACE_H */
+
+// the header is included again from this directory to define the events
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE aesd-trace
+#include <trace/define_trace.h>
@@ -33,14 +33,85 @@ struct aesd_seekto {
     uint32_t write_cmd_offset;
 };
 
+/**
+ * One record of a batch write: len bytes at offset in the payload, committed as one entry.
+ * The driver sets index to the index of the entry, the number of entries written to the
+ * device before it since the module was loaded.
+ */
+struct aesd_record {
+    uint32_t offset;
+    uint32_t len;
+    uint64_t index;
+};
+
+/**
+ * Records committed by AESDCHAR_IOCWRITEBATCH. records points to count struct aesd_record,
+ * payload to payload_len bytes, both user pointers cast to uint64_t.
+ */
+struct aesd_write_batch {
+    uint64_t records;
+    uint64_t payload;
+    uint32_t count;
+    uint32_t payload_len;
+};
+
+/**
+ * Moves the file to the oldest entry whose index, as in struct aesd_record, or timestamp,
+ * in ns of CLOCK_MONOTONIC when the entry was committed, is at or after value. The driver
+ * sets index and timestamp to those of that entry, or, when every entry is older, moves
+ * the file to the end of the data and sets index to that of the next entry and timestamp to 0.
+ */
+struct aesd_seekafter {
+    uint64_t value;
+    /**
+     * AESD_SEEK_BY_INDEX or AESD_SEEK_BY_TIME
+     */
+    uint32_t by;
+    /**
+     * Must be 0
+     */
+    uint32_t reserved;
+    uint64_t index;
+    uint64_t timestamp;
+};
+
+#define AESD_SEEK_BY_INDEX 0
+#define AESD_SEEK_BY_TIME 1
+
+/**
+ * Most records a batch write takes
+ */
+#define AESD_WRITE_BATCH_MAX 1024
+
+/**
+ * What a write does when making room would drop entries a file following
+ * the device with AESDCHAR_IOCFOLLOW has not read yet
+ */
+// drop them, the reader resumes at the oldest entry left
+#define AESD_POLICY_OVERWRITE 0
+// wait until the readers move past them, or fail with EAGAIN on an O_NONBLOCK file
+#define AESD_POLICY_BLOCK 1
+// fail with EAGAIN
+#define AESD_POLICY_EAGAIN 2
+
 // Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define AESD_IOC_MAGIC 0x16
 
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+// Follow the device like tail -f when the uint32_t passed is non zero: reads at the end
+// of the data wait for the next write, or fail with EAGAIN on an O_NONBLOCK file
+#define AESDCHAR_IOCFOLLOW _IOW(AESD_IOC_MAGIC, 2, uint32_t)
+// Commit each record of a struct aesd_write_batch as one entry under a single lock
+// acquisition, all of them or none. Returns the number of records and fills in their index.
+#define AESDCHAR_IOCWRITEBATCH _IOW(AESD_IOC_MAGIC, 3, struct aesd_write_batch)
+// Set the device's AESD_POLICY_* from the uint32_t passed, for every file of the device
+#define AESDCHAR_IOCSETPOLICY _IOW(AESD_IOC_MAGIC, 4, uint32_t)
+// Seek to the first entry at or after an index or time, see struct aesd_seekafter
+#define AESDCHAR_IOCSEEKAFTER _IOWR(AESD_IOC_MAGIC, 5, struct aesd_seekafter)
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 5
 
 #endif /* AESD_IOCTL_H */
@@ -0,0 +1,55 @@
+/*
+ * aesd_mmap.h
+ *
+ *  @brief Layout of the read only aesdchar mapping, shared by the driver and
+ *  userspace readers
+ *
+ *  The mapping starts with one header page, followed by the data ring mapped
+ *  twice in a row, so any range of up to ring_size bytes is contiguous.
+ *  Every byte written to the device has a stream offset, counted from module
+ *  load, and is stored at data[stream offset & (ring_size - 1)].
+ *
+ *  The driver moves tail past the bytes it is about to overwrite before it
+ *  copies a new entry in, and moves head once the entry is complete. A reader
+ *  that copied [pos, head) and then still finds tail <= pos got intact data.
+ */
+
+#ifndef AESD_MMAP_H
+#define AESD_MMAP_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#define AESD_MMAP_MAGIC     0x61657364u /* "aesd" */
+#define AESD_MMAP_VERSION   1
+
+/**
+ * Offset of the data ring in the mapping, the header takes one page
+ */
+#define AESD_MMAP_DATA_OFFSET(page_size) (page_size)
+
+struct aesd_mmap_header {
+    uint32_t magic;
+    uint32_t version;
+    /**
+     * Bytes in the data ring, a power of two
+     */
+    uint64_t ring_size;
+    /**
+     * Stream offset one past the last byte of the newest complete entry
+     */
+    uint64_t head;
+    /**
+     * Stream offset of the oldest byte still held by the ring
+     */
+    uint64_t tail;
+    /**
+     * Number of entries written since module load, changes with every entry
+     */
+    uint64_t seq;
+};
+
+#endif /* AESD_MMAP_H */
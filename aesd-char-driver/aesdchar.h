@@ -10,7 +10,7 @@
 #ifndef AESD_CHAR_DRIVER_AESDCHAR_H_
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 
-#define AESD_DEBUG 1  //Remove comment on this line to enable debug
+//#define AESD_DEBUG 1  //Remove comment on this line to enable debug, or build with DEBUG=y
 
 #undef PDEBUG             /* undef it, just in case */
 #ifdef AESD_DEBUG
@@ -25,6 +25,81 @@
 #  define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
 
+/**
+ * A page of a partial write, chained until a newline completes the entry
+ */
+struct aesd_stage_chunk
+{
+    struct list_head list;
+    size_t head; /* bytes at the start already taken into entries */
+    size_t used;
+    char data[];
+};
+
+#define AESD_STAGE_CHUNK_DATA (PAGE_SIZE - sizeof(struct aesd_stage_chunk))
+
+/**
+ * Bytes written since the last newline, kept in page sized chunks so
+ * appending to a long partial entry never copies what is already staged
+ */
+struct aesd_stage
+{
+    struct list_head chunks;
+    size_t size;
+};
+
+/**
+ * Storage behind an entry buffptr. Buffers of the size classes come from
+ * SLAB_TYPESAFE_BY_RCU caches, so their memory stays an entry buffer while
+ * lockless readers may copy from it, and are reused as soon as they are
+ * overwritten: a reader that raced with the reuse fails its seqcount check.
+ * Larger entries are kvmalloc'd and freed an RCU grace period after they
+ * are overwritten.
+ */
+struct aesd_entry_buf
+{
+    struct rcu_head rcu;
+    unsigned int size_class; /* AESD_ENTRY_CLASSES if kvmalloc'd */
+    char data[];
+};
+
+// entry size classes, slab objects of 64 bytes doubling up to 2KB
+#define AESD_ENTRY_CLASSES 6
+#define AESD_ENTRY_CLASS_SIZE(c) (64u << (c))
+
+/**
+ * Entry allocations of a device, indexed by size class with the kvmalloc'd
+ * entries last. Shown by the alloc file in debugfs.
+ */
+struct aesd_alloc_stats
+{
+    atomic64_t allocs[AESD_ENTRY_CLASSES + 1]; /* buffers allocated */
+    atomic64_t recycled[AESD_ENTRY_CLASSES + 1]; /* overwritten buffers reused instead */
+    atomic64_t alloc_ns[AESD_ENTRY_CLASSES + 1]; /* time spent allocating */
+    u64 alloc_ns_max[AESD_ENTRY_CLASSES + 1]; /* slowest allocation, updated racily */
+};
+
+// latency histogram buckets, bucket b counts times below 2^b ns
+#define AESD_LATENCY_BUCKETS 32
+
+/**
+ * Counters of a device, one copy per CPU summed by the debugfs files
+ */
+struct aesd_stats
+{
+    u64 reads; /* read calls that returned data or hit the end */
+    u64 read_bytes;
+    u64 writes; /* write calls */
+    u64 write_bytes;
+    u64 overwrites; /* entries dropped to make room for new ones */
+    u64 seeks; /* llseek, AESDCHAR_IOCSEEKTO and AESDCHAR_IOCSEEKAFTER calls */
+    u64 lock_waits; /* times dev->lock was contended */
+    u64 lock_wait_ns; /* time spent waiting for it */
+    s64 staged_bytes; /* bytes of partial lines held, may go negative on one CPU */
+    u64 read_latency[AESD_LATENCY_BUCKETS];
+    u64 write_latency[AESD_LATENCY_BUCKETS];
+};
+
 struct aesd_dev
 {
     /**
@@ -32,10 +107,64 @@ struct aesd_dev
      */
     struct cdev cdev;     /* Char device structure      */
     struct aesd_circular_buffer buffer; /* circular buffer */
-    struct aesd_buffer_entry entry; /* current entry */
-    struct mutex lock; /* mutex lock */
-    size_t total_buffer_size;
+    struct aesd_stage stage; /* partial entry left by files closed mid line */
+    struct mutex lock; /* mutex lock, serializes writers */
+    seqcount_mutex_t seq; /* bumped around buffer updates, readers retry on change */
+    wait_queue_head_t wait; /* woken for every committed entry */
+    struct aesd_mmap_header *mmap_header; /* header page of the mmap view, NULL if disabled */
+    char *mmap_ring; /* data ring mapped after the header page */
+    size_t max_bytes; /* limit of the bytes held by the buffer, 0 for none */
+    u64 records; /* entries committed since module load, the index of the next one */
+    uint32_t policy; /* AESD_POLICY_* for writes that would drop what followers have not read */
+    struct list_head followers; /* files with follow set, on aesd_file.follower */
+    wait_queue_head_t room; /* woken when followers advance or the policy changes */
+    u64 room_events; /* bumped with every wake of room, writers wait for it to change */
+    struct aesd_entry_buf *spare[AESD_ENTRY_CLASSES]; /* an overwritten buffer per size class for the next write */
+    struct aesd_alloc_stats alloc_stats;
+    struct aesd_stats __percpu *stats;
+} ____cacheline_aligned_in_smp;
+
+/**
+ * Where the last read stopped: free running buffer index of the entry,
+ * byte offset within it and the matching file position. Valid only while
+ * generation matches the buffer generation.
+ */
+struct aesd_cursor
+{
+    uint32_t index;
+    size_t offset;
+    loff_t fpos;
+    uint32_t generation;
 };
 
+/**
+ * Per open file state, stored in filp->private_data
+ */
+struct aesd_file
+{
+    struct aesd_dev *dev;
+    /**
+     * Read position, only touched under read_lock
+     */
+    struct aesd_cursor cursor;
+    struct mutex read_lock;
+    /**
+     * Set with AESDCHAR_IOCFOLLOW: reads at the end wait for new entries
+     * and keep their place in the data as older entries are overwritten
+     */
+    bool follow;
+    /**
+     * While following, the index of the next entry this file reads, which
+     * writers do not drop unless the device policy is AESD_POLICY_OVERWRITE.
+     * Both only change under read_lock and dev->lock.
+     */
+    u64 read_seq;
+    struct list_head follower;
+    /**
+     * Bytes this file wrote since its last newline, only touched under write_lock
+     */
+    struct aesd_stage stage;
+    struct mutex write_lock;
+};
 
 #endif /* AESD_CHAR_DRIVER_AESDCHAR_H_ */
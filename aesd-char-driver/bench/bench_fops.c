@@ -0,0 +1,361 @@
+/**
+ * @file bench_fops.c
+ * @brief Throughput and latency of the aesdchar file operations, run in userspace
+ *
+ * Builds main.c against the kernel shim in kshim/ and drives its file operations
+ * from threads: writers append lines with write() or in batches through
+ * AESDCHAR_IOCWRITEBATCH, readers read the device from the start in chunks and
+ * llseek() back to 0 at its end, until the writers are done. With -f readers
+ * follow the device instead, from its start, with nonblocking reads, which
+ * full_policy=1 keeps writers from outrunning. Each operation is
+ * timed, percentiles come from per thread log2 histograms, so a value is the
+ * power of two its bucket ends at.
+ *
+ * Usage: ./bench_fops [-w writers] [-r readers] [-n writes] [-l line] [-b batch]
+ *                     [-c chunk] [-f] [-d] [param=value ...]
+ *
+ * -n is per writer, -b sends that many lines per ioctl, -d prints the driver's
+ * debugfs files at the end. Trailing arguments are module parameters, like
+ * max_entries=1024 or max_bytes=65536.
+ */
+
+#include <unistd.h>
+#include "kshim.h"
+#include "../aesd_ioctl.h"
+
+#define BENCH_BUCKETS 48
+#define BENCH_MAX_THREADS 64
+
+extern int aesd_init_module(void);
+extern void aesd_cleanup_module(void);
+
+enum bench_op
+{
+    bench_op_write,
+    bench_op_read,
+    bench_op_seek,
+    bench_ops,
+};
+
+static const char *const bench_op_names[bench_ops] = { "write", "read", "llseek" };
+
+struct bench_thread
+{
+    pthread_t thread;
+    unsigned int id;
+    struct file filp;
+    u64 ops[bench_ops];
+    u64 bytes[bench_ops];
+    u64 max_ns[bench_ops];
+    u64 latency[bench_ops][BENCH_BUCKETS];
+};
+
+static unsigned int writers = 2;
+static unsigned int readers = 2;
+static unsigned long writes = 100000;
+static unsigned int line_len = 64;
+static unsigned int batch;
+static unsigned int chunk = 4096;
+static bool follow;
+static unsigned int writers_done;
+
+static void bench_record(struct bench_thread *t, enum bench_op op, u64 ns, ssize_t bytes)
+{
+    int bucket = min(fls64(ns), BENCH_BUCKETS - 1);
+
+    t->ops[op]++;
+    t->bytes[op] += (bytes > 0) ? bytes : 0;
+    t->latency[op][bucket]++;
+    t->max_ns[op] = max(t->max_ns[op], ns);
+}
+
+static const struct file_operations *bench_fops(struct file *filp)
+{
+    return filp->f_inode->i_cdev->ops;
+}
+
+static void bench_fill_line(char *line, unsigned int writer, unsigned long n)
+{
+    int len = snprintf(line, line_len, "w%u %lu ", writer, n);
+
+    if(len < (int)line_len - 1)
+    {
+        memset(line + len, 'a' + (n % 26), line_len - 1 - len);
+    }
+    line[line_len - 1] = '\n';
+}
+
+static void *bench_writer(void *arg)
+{
+    struct bench_thread *t = arg;
+    unsigned int per_call = (batch != 0) ? batch : 1;
+    char *payload = malloc((size_t)per_call * line_len);
+    struct aesd_record *records = calloc(per_call, sizeof(*records));
+    unsigned long n = 0;
+
+    if((payload == NULL) || (records == NULL))
+    {
+        fprintf(stderr, "writer %u: out of memory\n", t->id);
+        exit(1);
+    }
+    while(n < writes)
+    {
+        unsigned int count = min_t(unsigned long, per_call, writes - n);
+        unsigned int i;
+        ssize_t result;
+        u64 start;
+
+        for(i = 0; i < count; i++)
+        {
+            bench_fill_line(payload + ((size_t)i * line_len), t->id, n + i);
+            records[i].offset = i * line_len;
+            records[i].len = line_len;
+        }
+        start = ktime_get_ns();
+        if(batch == 0)
+        {
+            result = bench_fops(&t->filp)->write(&t->filp, payload, line_len, &t->filp.f_pos);
+        }
+        else
+        {
+            struct aesd_write_batch request = {
+                .records = (uintptr_t)records,
+                .payload = (uintptr_t)payload,
+                .count = count,
+                .payload_len = count * line_len,
+            };
+
+            result = bench_fops(&t->filp)->unlocked_ioctl(&t->filp, AESDCHAR_IOCWRITEBATCH,
+                                                          (unsigned long)&request);
+            result = (result == count) ? (ssize_t)count * line_len : -1;
+        }
+        if(result < 0)
+        {
+            fprintf(stderr, "writer %u: write failed with %zd\n", t->id, result);
+            exit(1);
+        }
+        bench_record(t, bench_op_write, ktime_get_ns() - start, result);
+        n += count;
+    }
+    __atomic_fetch_add(&writers_done, 1, __ATOMIC_RELEASE);
+    free(records);
+    free(payload);
+    return NULL;
+}
+
+static void *bench_reader(void *arg)
+{
+    struct bench_thread *t = arg;
+    char *buf = malloc(chunk);
+
+    if(buf == NULL)
+    {
+        fprintf(stderr, "reader %u: out of memory\n", t->id);
+        exit(1);
+    }
+    while(__atomic_load_n(&writers_done, __ATOMIC_ACQUIRE) < writers)
+    {
+        u64 start = ktime_get_ns();
+        ssize_t result = bench_fops(&t->filp)->read(&t->filp, buf, chunk, &t->filp.f_pos);
+
+        if(result == -EAGAIN)
+        {
+            // a follower caught up with the writers
+            sched_yield();
+            continue;
+        }
+        if(result < 0)
+        {
+            fprintf(stderr, "reader %u: read failed with %zd\n", t->id, result);
+            exit(1);
+        }
+        bench_record(t, bench_op_read, ktime_get_ns() - start, result);
+        if((result == 0) && !follow)
+        {
+            start = ktime_get_ns();
+            bench_fops(&t->filp)->llseek(&t->filp, 0, SEEK_SET);
+            bench_record(t, bench_op_seek, ktime_get_ns() - start, 0);
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+/**
+ * @return the upper bound in ns of the bucket holding the @param permille of @param latency
+ */
+static u64 bench_percentile(const u64 *latency, u64 ops, unsigned int permille)
+{
+    u64 target = ((ops * permille) + 999) / 1000;
+    u64 seen = 0;
+    int b;
+
+    for(b = 0; b < BENCH_BUCKETS; b++)
+    {
+        seen += latency[b];
+        if((seen >= target) && (seen != 0))
+        {
+            return 1ull << b;
+        }
+    }
+    return 0;
+}
+
+static void bench_report(struct bench_thread *threads, unsigned int count, double seconds)
+{
+    enum bench_op op;
+
+    printf("%-7s %10s %12s %10s %10s %10s %10s %10s\n", "op", "ops", "ops/s", "MB/s",
+           "p50(ns)", "p99(ns)", "p99.9(ns)", "max(ns)");
+    for(op = 0; op < bench_ops; op++)
+    {
+        u64 latency[BENCH_BUCKETS] = { 0 };
+        u64 ops = 0;
+        u64 bytes = 0;
+        u64 max_ns = 0;
+        unsigned int i;
+        int b;
+
+        for(i = 0; i < count; i++)
+        {
+            ops += threads[i].ops[op];
+            bytes += threads[i].bytes[op];
+            max_ns = max(max_ns, threads[i].max_ns[op]);
+            for(b = 0; b < BENCH_BUCKETS; b++)
+            {
+                latency[b] += threads[i].latency[op][b];
+            }
+        }
+        if(ops == 0)
+        {
+            continue;
+        }
+        printf("%-7s %10llu %12.0f %10.1f %10llu %10llu %10llu %10llu\n", bench_op_names[op],
+               ops, ops / seconds, bytes / seconds / 1e6,
+               bench_percentile(latency, ops, 500), bench_percentile(latency, ops, 990),
+               bench_percentile(latency, ops, 999), max_ns);
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-w writers] [-r readers] [-n writes] [-l line] [-b batch]"
+                    " [-c chunk] [-f] [-d] [param=value ...]\n", name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct bench_thread threads[BENCH_MAX_THREADS];
+    bool debugfs = false;
+    unsigned int i;
+    u64 start;
+    double seconds;
+    int opt;
+
+    while((opt = getopt(argc, argv, "w:r:n:l:b:c:fd")) != -1)
+    {
+        switch(opt)
+        {
+            case 'w':
+                writers = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                readers = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                writes = strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                line_len = strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                batch = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                chunk = strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                follow = true;
+                break;
+            case 'd':
+                debugfs = true;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if((writers == 0) || (writers + readers > BENCH_MAX_THREADS) || (line_len < 2) ||
+       (batch > AESD_WRITE_BATCH_MAX) || (chunk == 0))
+    {
+        usage(argv[0]);
+    }
+    for(; optind < argc; optind++)
+    {
+        if(kshim_param_set(argv[optind]) != 0)
+        {
+            fprintf(stderr, "Unknown or invalid module parameter %s\n", argv[optind]);
+            return 1;
+        }
+    }
+    if(aesd_init_module() != 0)
+    {
+        fprintf(stderr, "aesd_init_module failed\n");
+        return 1;
+    }
+
+    for(i = 0; i < writers + readers; i++)
+    {
+        uint32_t on = 1;
+
+        threads[i].id = i;
+        if(kshim_open(0, (i < writers) ? O_WRONLY : O_RDONLY | O_NONBLOCK, &threads[i].filp) != 0)
+        {
+            fprintf(stderr, "open failed\n");
+            return 1;
+        }
+        // followers start before the writers, so they see every entry
+        if((i >= writers) && follow &&
+           (bench_fops(&threads[i].filp)->unlocked_ioctl(&threads[i].filp, AESDCHAR_IOCFOLLOW,
+                                                         (unsigned long)&on) != 0))
+        {
+            fprintf(stderr, "AESDCHAR_IOCFOLLOW failed\n");
+            return 1;
+        }
+    }
+    start = ktime_get_ns();
+    for(i = 0; i < writers + readers; i++)
+    {
+        if(pthread_create(&threads[i].thread, NULL, (i < writers) ? bench_writer : bench_reader,
+                          &threads[i]) != 0)
+        {
+            fprintf(stderr, "pthread_create failed\n");
+            return 1;
+        }
+    }
+    for(i = 0; i < writers + readers; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+    }
+    seconds = (ktime_get_ns() - start) / 1e9;
+
+    printf("%u writers, %u %sreaders, %lu writes of %u bytes each%s, %.3f s\n", writers, readers,
+           follow ? "following " : "", writes, line_len, (batch != 0) ? " in batches" : "", seconds);
+    bench_report(threads, writers + readers, seconds);
+    if(debugfs)
+    {
+        printf("\nstats:\n");
+        kshim_debugfs_print("aesdchar/aesdchar0/stats", stdout);
+        printf("\nlatency:\n");
+        kshim_debugfs_print("aesdchar/aesdchar0/latency", stdout);
+        printf("\nalloc:\n");
+        kshim_debugfs_print("aesdchar/aesdchar0/alloc", stdout);
+    }
+
+    for(i = 0; i < writers + readers; i++)
+    {
+        kshim_release(&threads[i].filp);
+    }
+    aesd_cleanup_module();
+    return 0;
+}
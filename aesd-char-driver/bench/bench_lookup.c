@@ -0,0 +1,124 @@
+/**
+ * @file bench_lookup.c
+ * @brief Compares aesd_circular_buffer_find_entry_offset_for_fpos() against a linear walk
+ *
+ * Fills buffers of increasing capacity with variable sized entries, wrapping each
+ * once so eviction has moved the base offset, then times random lookups with both.
+ *
+ * Usage: ./bench_lookup [lookups]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../aesd-circular-buffer.h"
+
+static const uint32_t capacities[] = { 16, 256, 4096, 65536 };
+
+static char data[256];
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+/**
+ * The lookup as it was before the prefix sum index, walking from the oldest entry
+ */
+static struct aesd_buffer_entry *linear_find(struct aesd_circular_buffer *buffer,
+            size_t char_offset, size_t *entry_offset_byte_rtn)
+{
+    uint32_t index;
+    struct aesd_buffer_entry *entry;
+
+    for(index = buffer->out_offs; index != buffer->in_offs; index++)
+    {
+        entry = &buffer->entry[index & buffer->mask];
+        if(char_offset < entry->size)
+        {
+            *entry_offset_byte_rtn = char_offset;
+            return entry;
+        }
+        char_offset -= entry->size;
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t lookups = (argc > 1) ? strtoul(argv[1], NULL, 0) : 200000;
+    size_t *offsets;
+    size_t i;
+    size_t c;
+    size_t total;
+    size_t entry_offset = 0;
+    size_t linear_offset = 0;
+    uint64_t start;
+    uint64_t indexed_ns;
+    uint64_t linear_ns;
+    uintptr_t check = 0;
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entry;
+    struct aesd_buffer_entry *found;
+
+    offsets = malloc(lookups * sizeof(size_t));
+    if(offsets == NULL)
+    {
+        return 1;
+    }
+    memset(data, 'x', sizeof(data));
+    srand(1);
+
+    printf("%10s %10s %14s %14s %9s\n", "entries", "bytes", "indexed(ns)", "linear(ns)", "speedup");
+    for(c = 0; c < sizeof(capacities) / sizeof(capacities[0]); c++)
+    {
+        if(aesd_circular_buffer_init_capacity(&buffer, capacities[c]) != 0)
+        {
+            return 1;
+        }
+        for(i = 0; i < (2 * (size_t)capacities[c]); i++)
+        {
+            entry.buffptr = data;
+            entry.size = 1 + (rand() % sizeof(data));
+            aesd_circular_buffer_add_entry(&buffer, &entry);
+        }
+
+        total = aesd_circular_buffer_size(&buffer);
+        for(i = 0; i < lookups; i++)
+        {
+            offsets[i] = rand() % total;
+            found = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, offsets[i], &entry_offset);
+            if((found != linear_find(&buffer, offsets[i], &linear_offset)) || (entry_offset != linear_offset))
+            {
+                fprintf(stderr, "lookup mismatch at offset %zu\n", offsets[i]);
+                return 1;
+            }
+        }
+
+        start = now_ns();
+        for(i = 0; i < lookups; i++)
+        {
+            check += (uintptr_t)aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, offsets[i], &entry_offset);
+        }
+        indexed_ns = now_ns() - start;
+
+        start = now_ns();
+        for(i = 0; i < lookups; i++)
+        {
+            check += (uintptr_t)linear_find(&buffer, offsets[i], &entry_offset);
+        }
+        linear_ns = now_ns() - start;
+
+        printf("%10u %10zu %14.1f %14.1f %8.1fx\n", capacities[c], total,
+                indexed_ns / (double)lookups, linear_ns / (double)lookups,
+                linear_ns / (double)indexed_ns);
+        aesd_circular_buffer_free(&buffer);
+    }
+
+    free(offsets);
+    return (check == 0);
+}
@@ -0,0 +1,567 @@
+/**
+ * @file kshim.c
+ * @brief Userspace implementation of the kernel APIs declared in kshim.h
+ */
+
+#include "kshim.h"
+
+#include <unistd.h>
+
+/* ----------------------------------------------------- module parameters */
+
+#define KSHIM_MAX_PARAMS 32
+
+struct kshim_param
+{
+    const char *name;
+    void *addr;
+    enum kshim_param_type type;
+    int *count;
+    unsigned int max;
+};
+
+static struct kshim_param kshim_params[KSHIM_MAX_PARAMS];
+static unsigned int kshim_param_count;
+
+void kshim_param_add(const char *name, void *addr, enum kshim_param_type type,
+                     int *count, unsigned int max)
+{
+    if(kshim_param_count < KSHIM_MAX_PARAMS)
+    {
+        struct kshim_param *param = &kshim_params[kshim_param_count++];
+
+        param->name = name;
+        param->addr = addr;
+        param->type = type;
+        param->count = count;
+        param->max = max;
+    }
+}
+
+int kshim_param_set(const char *arg)
+{
+    const char *value = strchr(arg, '=');
+    unsigned int i;
+
+    if(value == NULL)
+    {
+        return -1;
+    }
+    for(i = 0; i < kshim_param_count; i++)
+    {
+        struct kshim_param *param = &kshim_params[i];
+        const char *pos = value + 1;
+        unsigned int n = 0;
+
+        if((strlen(param->name) != (size_t)(value - arg)) ||
+           (strncmp(param->name, arg, value - arg) != 0))
+        {
+            continue;
+        }
+        while(n < param->max)
+        {
+            char *end;
+            unsigned long v = strtoul(pos, &end, 0);
+
+            if(end == pos)
+            {
+                return -1;
+            }
+            if(param->type == kshim_param_type_uint)
+            {
+                ((unsigned int *)param->addr)[n] = (unsigned int)v;
+            }
+            else
+            {
+                ((unsigned long *)param->addr)[n] = v;
+            }
+            n++;
+            if(*end != ',')
+            {
+                if(*end != '\0')
+                {
+                    return -1;
+                }
+                break;
+            }
+            pos = end + 1;
+        }
+        if(param->count != NULL)
+        {
+            *param->count = (int)n;
+        }
+        return 0;
+    }
+    return -1;
+}
+
+/* ------------------------------------------------------------ slab caches */
+
+struct kmem_cache *kmem_cache_create(const char *name, unsigned int size, unsigned int align,
+                                     unsigned long flags, void (*ctor)(void *))
+{
+    struct kmem_cache *cache = calloc(1, sizeof(*cache));
+
+    (void)name;
+    (void)align;
+    (void)flags;
+    (void)ctor;
+    if(cache != NULL)
+    {
+        // free objects keep the free list link in their first bytes
+        cache->size = max_t(size_t, size, sizeof(void *));
+        pthread_mutex_init(&cache->lock, NULL);
+    }
+    return cache;
+}
+
+void kmem_cache_destroy(struct kmem_cache *cache)
+{
+    if(cache == NULL)
+    {
+        return;
+    }
+    while(cache->free != NULL)
+    {
+        void *obj = cache->free;
+
+        cache->free = *(void **)obj;
+        free(obj);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache, gfp_t gfp)
+{
+    void *obj;
+
+    (void)gfp;
+    pthread_mutex_lock(&cache->lock);
+    obj = cache->free;
+    if(obj != NULL)
+    {
+        cache->free = *(void **)obj;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return (obj != NULL) ? obj : malloc(cache->size);
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+    if(obj == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    *(void **)obj = cache->free;
+    cache->free = obj;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/* -------------------------------------------------------------------- RCU */
+
+pthread_rwlock_t kshim_rcu_lock;
+static pthread_mutex_t kshim_rcu_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t kshim_rcu_queue_cond = PTHREAD_COND_INITIALIZER;
+static struct rcu_head *kshim_rcu_queue;
+static u64 kshim_rcu_queued;
+static u64 kshim_rcu_done;
+static pthread_once_t kshim_rcu_once = PTHREAD_ONCE_INIT;
+
+static void __attribute__((constructor)) kshim_rcu_init(void)
+{
+    pthread_rwlockattr_t attr;
+
+    pthread_rwlockattr_init(&attr);
+    // a steady stream of readers must not hold off the grace period
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&kshim_rcu_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+/**
+ * Waits out a grace period for everything queued so far, then runs it.
+ * call_rcu() may be called where readers wait for the caller, like inside
+ * a seqcount write section, so grace periods never run on the caller's thread.
+ */
+static void *kshim_rcu_thread(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&kshim_rcu_queue_lock);
+    for(;;)
+    {
+        struct rcu_head *head;
+        u64 count = 0;
+
+        while(kshim_rcu_queue == NULL)
+        {
+            pthread_cond_wait(&kshim_rcu_queue_cond, &kshim_rcu_queue_lock);
+        }
+        head = kshim_rcu_queue;
+        kshim_rcu_queue = NULL;
+        pthread_mutex_unlock(&kshim_rcu_queue_lock);
+
+        // once the write lock is held every reader that could see them has left
+        pthread_rwlock_wrlock(&kshim_rcu_lock);
+        pthread_rwlock_unlock(&kshim_rcu_lock);
+        while(head != NULL)
+        {
+            struct rcu_head *next = head->next;
+
+            head->func(head);
+            head = next;
+            count++;
+        }
+
+        pthread_mutex_lock(&kshim_rcu_queue_lock);
+        kshim_rcu_done += count;
+        pthread_cond_broadcast(&kshim_rcu_queue_cond);
+    }
+    return NULL;
+}
+
+static void kshim_rcu_start(void)
+{
+    pthread_t thread;
+
+    if(pthread_create(&thread, NULL, kshim_rcu_thread, NULL) != 0)
+    {
+        fprintf(stderr, "kshim: can not start the RCU thread\n");
+        abort();
+    }
+    pthread_detach(thread);
+}
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head))
+{
+    pthread_once(&kshim_rcu_once, kshim_rcu_start);
+    head->func = func;
+    pthread_mutex_lock(&kshim_rcu_queue_lock);
+    head->next = kshim_rcu_queue;
+    kshim_rcu_queue = head;
+    kshim_rcu_queued++;
+    pthread_cond_broadcast(&kshim_rcu_queue_cond);
+    pthread_mutex_unlock(&kshim_rcu_queue_lock);
+}
+
+void rcu_barrier(void)
+{
+    pthread_mutex_lock(&kshim_rcu_queue_lock);
+    while(kshim_rcu_done != kshim_rcu_queued)
+    {
+        pthread_cond_wait(&kshim_rcu_queue_cond, &kshim_rcu_queue_lock);
+    }
+    pthread_mutex_unlock(&kshim_rcu_queue_lock);
+}
+
+/* ------------------------------------------------------------- iov_iter */
+
+static size_t kshim_iter_copy(struct iov_iter *iter, char *buf, size_t bytes, bool to_iter)
+{
+    size_t done = 0;
+
+    while((done < bytes) && (iter->nr_segs > 0))
+    {
+        char *base = (char *)iter->iov->iov_base + iter->iov_offset;
+        size_t n = min(iter->iov->iov_len - iter->iov_offset, bytes - done);
+
+        if(to_iter)
+        {
+            memcpy(base, buf + done, n);
+        }
+        else
+        {
+            memcpy(buf + done, base, n);
+        }
+        done += n;
+        iter->iov_offset += n;
+        if(iter->iov_offset == iter->iov->iov_len)
+        {
+            iter->iov++;
+            iter->nr_segs--;
+            iter->iov_offset = 0;
+        }
+    }
+    iter->count -= done;
+    return done;
+}
+
+size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *iter)
+{
+    return kshim_iter_copy(iter, (char *)addr, bytes, true);
+}
+
+size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *iter)
+{
+    return kshim_iter_copy(iter, addr, bytes, false);
+}
+
+/* ----------------------------------------------------------- files, VFS */
+
+#define KSHIM_MAX_CDEVS 16
+#define KSHIM_MAJOR 240
+
+static struct cdev *kshim_cdevs[KSHIM_MAX_CDEVS];
+
+loff_t fixed_size_llseek(struct file *filp, loff_t off, int whence, loff_t size)
+{
+    loff_t pos;
+
+    switch(whence)
+    {
+        case SEEK_SET:
+            pos = off;
+            break;
+        case SEEK_CUR:
+            pos = filp->f_pos + off;
+            break;
+        case SEEK_END:
+            pos = size + off;
+            break;
+        default:
+            return -EINVAL;
+    }
+    if((pos < 0) || (pos > size))
+    {
+        return -EINVAL;
+    }
+    filp->f_pos = pos;
+    return pos;
+}
+
+ssize_t copy_splice_read(struct file *in, loff_t *ppos, struct pipe_inode_info *pipe,
+                         size_t len, unsigned int flags)
+{
+    (void)in;
+    (void)ppos;
+    (void)pipe;
+    (void)len;
+    (void)flags;
+    return -EINVAL;
+}
+
+int alloc_chrdev_region(dev_t *dev, unsigned int baseminor, unsigned int count, const char *name)
+{
+    (void)name;
+    if(baseminor + count > KSHIM_MAX_CDEVS)
+    {
+        return -EBUSY;
+    }
+    *dev = MKDEV(KSHIM_MAJOR, baseminor);
+    return 0;
+}
+
+void unregister_chrdev_region(dev_t dev, unsigned int count)
+{
+    (void)dev;
+    (void)count;
+}
+
+void cdev_init(struct cdev *cdev, const struct file_operations *fops)
+{
+    memset(cdev, 0, sizeof(*cdev));
+    cdev->ops = fops;
+}
+
+int cdev_add(struct cdev *cdev, dev_t dev, unsigned int count)
+{
+    unsigned int minor = MINOR(dev);
+
+    if((count != 1) || (minor >= KSHIM_MAX_CDEVS))
+    {
+        return -EINVAL;
+    }
+    cdev->dev = dev;
+    kshim_cdevs[minor] = cdev;
+    return 0;
+}
+
+void cdev_del(struct cdev *cdev)
+{
+    unsigned int minor = MINOR(cdev->dev);
+
+    if((minor < KSHIM_MAX_CDEVS) && (kshim_cdevs[minor] == cdev))
+    {
+        kshim_cdevs[minor] = NULL;
+    }
+}
+
+int kshim_open(unsigned int minor, unsigned int flags, struct file *filp)
+{
+    struct cdev *cdev = (minor < KSHIM_MAX_CDEVS) ? kshim_cdevs[minor] : NULL;
+    struct inode *inode;
+    int result;
+
+    if(cdev == NULL)
+    {
+        return -ENXIO;
+    }
+    inode = calloc(1, sizeof(*inode));
+    if(inode == NULL)
+    {
+        return -ENOMEM;
+    }
+    inode->i_cdev = cdev;
+    memset(filp, 0, sizeof(*filp));
+    filp->f_inode = inode;
+    filp->f_flags = flags;
+    result = cdev->ops->open(inode, filp);
+    if(result != 0)
+    {
+        free(inode);
+        filp->f_inode = NULL;
+    }
+    return result;
+}
+
+int kshim_release(struct file *filp)
+{
+    struct inode *inode = filp->f_inode;
+    int result = inode->i_cdev->ops->release(inode, filp);
+
+    free(inode);
+    filp->f_inode = NULL;
+    return result;
+}
+
+/* ---------------------------------------------------------------- debugfs */
+
+#define KSHIM_MAX_DENTRIES 64
+
+struct dentry
+{
+    char name[64];
+    struct dentry *parent;
+    void *data;
+    const struct file_operations *fops;
+};
+
+static struct dentry *kshim_dentries[KSHIM_MAX_DENTRIES];
+static pthread_mutex_t kshim_dentries_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct dentry *kshim_dentry_add(const char *name, struct dentry *parent,
+                                       void *data, const struct file_operations *fops)
+{
+    struct dentry *dentry = calloc(1, sizeof(*dentry));
+    unsigned int i;
+
+    if(dentry == NULL)
+    {
+        return NULL;
+    }
+    snprintf(dentry->name, sizeof(dentry->name), "%s", name);
+    dentry->parent = parent;
+    dentry->data = data;
+    dentry->fops = fops;
+    pthread_mutex_lock(&kshim_dentries_lock);
+    for(i = 0; i < KSHIM_MAX_DENTRIES; i++)
+    {
+        if(kshim_dentries[i] == NULL)
+        {
+            kshim_dentries[i] = dentry;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&kshim_dentries_lock);
+    if(i == KSHIM_MAX_DENTRIES)
+    {
+        free(dentry);
+        return NULL;
+    }
+    return dentry;
+}
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent)
+{
+    return kshim_dentry_add(name, parent, NULL, NULL);
+}
+
+struct dentry *debugfs_create_file(const char *name, unsigned short mode, struct dentry *parent,
+                                   void *data, const struct file_operations *fops)
+{
+    (void)mode;
+    return kshim_dentry_add(name, parent, data, fops);
+}
+
+static bool kshim_dentry_under(const struct dentry *dentry, const struct dentry *ancestor)
+{
+    for(; dentry != NULL; dentry = dentry->parent)
+    {
+        if(dentry == ancestor)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void debugfs_remove_recursive(struct dentry *dentry)
+{
+    unsigned int i;
+
+    if(dentry == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&kshim_dentries_lock);
+    // children come after their parents, free them first
+    for(i = KSHIM_MAX_DENTRIES; i-- > 0;)
+    {
+        if((kshim_dentries[i] != NULL) && kshim_dentry_under(kshim_dentries[i], dentry))
+        {
+            free(kshim_dentries[i]);
+            kshim_dentries[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&kshim_dentries_lock);
+}
+
+static bool kshim_dentry_matches(const struct dentry *dentry, const char *path, size_t len)
+{
+    size_t name_len = strlen(dentry->name);
+
+    // path[0..len) has to end in the name, after a '/' unless it is the root
+    if((name_len > len) || (strncmp(dentry->name, path + len - name_len, name_len) != 0))
+    {
+        return false;
+    }
+    if(dentry->parent == NULL)
+    {
+        return name_len == len;
+    }
+    if((name_len == len) || (path[len - name_len - 1] != '/'))
+    {
+        return false;
+    }
+    return kshim_dentry_matches(dentry->parent, path, len - name_len - 1);
+}
+
+int kshim_debugfs_print(const char *path, FILE *out)
+{
+    struct dentry *found = NULL;
+    unsigned int i;
+
+    pthread_mutex_lock(&kshim_dentries_lock);
+    for(i = 0; i < KSHIM_MAX_DENTRIES; i++)
+    {
+        struct dentry *dentry = kshim_dentries[i];
+
+        if((dentry != NULL) && (dentry->fops != NULL) &&
+           kshim_dentry_matches(dentry, path, strlen(path)))
+        {
+            found = dentry;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&kshim_dentries_lock);
+    if((found == NULL) || (found->fops->show == NULL))
+    {
+        return -1;
+    }
+    {
+        struct seq_file s = { .out = out, .private = found->data };
+
+        return (found->fops->show(&s, NULL) == 0) ? 0 : -1;
+    }
+}
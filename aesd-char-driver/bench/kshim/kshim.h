@@ -0,0 +1,626 @@
+/**
+ * @file kshim.h
+ * @brief Userspace stand ins for the kernel APIs used by the aesdchar driver
+ *
+ * Lets main.c and aesd-circular-buffer.c build and run as a normal program,
+ * for benchmarks and stress tests without root or a module build. Every
+ * <linux/...> header the driver includes resolves to this file through
+ * kshim/linux/. Only what the driver uses is here, and only as far as a
+ * single process needs it: there are no signals, so interruptible waits
+ * never fail, memory never faults, and per CPU data has a single copy
+ * updated atomically.
+ *
+ * The kshim_ functions at the end stand in for the VFS and insmod.
+ */
+
+#ifndef KSHIM_H
+#define KSHIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* ---------------------------------------------------------------- types */
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef long long s64;
+typedef unsigned int gfp_t;
+typedef unsigned int fmode_t;
+typedef unsigned int __poll_t;
+typedef unsigned int uint;
+typedef unsigned long ulong;
+#define loff_t long long
+
+#define __user
+#define __rcu
+#define __percpu
+#define __init
+#define __exit
+#define ____cacheline_aligned_in_smp __attribute__((aligned(64)))
+
+#define likely(x) (x)
+#define unlikely(x) (x)
+
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#define min_t(type, a, b) (((type)(a) < (type)(b)) ? (type)(a) : (type)(b))
+#define max_t(type, a, b) (((type)(a) > (type)(b)) ? (type)(a) : (type)(b))
+
+#define u64_to_user_ptr(x) ((void *)(uintptr_t)(x))
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1ul << PAGE_SHIFT)
+
+#define ERESTARTSYS 512
+
+static inline unsigned long roundup_pow_of_two(unsigned long n)
+{
+    unsigned long r = 1;
+
+    while(r < n)
+    {
+        r <<= 1;
+    }
+    return r;
+}
+
+static inline int fls64(u64 x)
+{
+    return (x != 0) ? 64 - __builtin_clzll(x) : 0;
+}
+
+/* ------------------------------------------------------ printk, modules */
+
+#define KERN_DEBUG ""
+#define KERN_INFO ""
+#define KERN_WARNING ""
+#define KERN_ERR ""
+
+#define printk(...) fprintf(stderr, __VA_ARGS__)
+
+struct module;
+#define THIS_MODULE ((struct module *)NULL)
+#define MODULE_AUTHOR(x)
+#define MODULE_LICENSE(x)
+#define MODULE_PARM_DESC(name, desc)
+#define module_init(fn)
+#define module_exit(fn)
+
+#define S_IRUGO 0444
+
+enum kshim_param_type
+{
+    kshim_param_type_uint,
+    kshim_param_type_ulong,
+};
+
+extern void kshim_param_add(const char *name, void *addr, enum kshim_param_type type,
+                            int *count, unsigned int max);
+
+// parameters register themselves before main(), see kshim_param_set()
+#define module_param(name, type, perm) \
+    static void __attribute__((constructor)) kshim_param_##name(void) \
+    { \
+        kshim_param_add(#name, &(name), kshim_param_type_##type, NULL, 1); \
+    }
+
+#define module_param_array(name, type, nump, perm) \
+    static void __attribute__((constructor)) kshim_param_##name(void) \
+    { \
+        kshim_param_add(#name, (name), kshim_param_type_##type, (nump), \
+                        sizeof(name) / sizeof((name)[0])); \
+    }
+
+/* ------------------------------------------------------------- atomics */
+
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define xchg(ptr, v) __atomic_exchange_n((ptr), (v), __ATOMIC_SEQ_CST)
+#define cmpxchg(ptr, old, new) \
+    ({ \
+        __typeof__(*(ptr)) __old = (old); \
+        __atomic_compare_exchange_n((ptr), &__old, (new), false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
+        __old; \
+    })
+
+typedef struct
+{
+    s64 counter;
+} atomic64_t;
+
+static inline void atomic64_add(s64 i, atomic64_t *v)
+{
+    __atomic_fetch_add(&v->counter, i, __ATOMIC_RELAXED);
+}
+
+static inline void atomic64_inc(atomic64_t *v)
+{
+    atomic64_add(1, v);
+}
+
+static inline s64 atomic64_read(const atomic64_t *v)
+{
+    return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+
+/* -------------------------------------------------------------- per CPU */
+
+#define alloc_percpu(type) ((type *)calloc(1, sizeof(type)))
+#define free_percpu(ptr) free(ptr)
+#define per_cpu_ptr(ptr, cpu) ((void)(cpu), (ptr))
+#define for_each_possible_cpu(cpu) for((cpu) = 0; (cpu) < 1; (cpu)++)
+#define this_cpu_add(var, v) __atomic_fetch_add(&(var), (v), __ATOMIC_RELAXED)
+#define this_cpu_inc(var) this_cpu_add(var, 1)
+
+/* ---------------------------------------------------------------- mutex */
+
+struct mutex
+{
+    pthread_mutex_t m;
+};
+
+static inline void mutex_init(struct mutex *lock)
+{
+    pthread_mutex_init(&lock->m, NULL);
+}
+
+static inline void mutex_destroy(struct mutex *lock)
+{
+    pthread_mutex_destroy(&lock->m);
+}
+
+static inline void mutex_lock(struct mutex *lock)
+{
+    pthread_mutex_lock(&lock->m);
+}
+
+static inline int mutex_lock_interruptible(struct mutex *lock)
+{
+    pthread_mutex_lock(&lock->m);
+    return 0;
+}
+
+static inline int mutex_trylock(struct mutex *lock)
+{
+    return pthread_mutex_trylock(&lock->m) == 0;
+}
+
+static inline void mutex_unlock(struct mutex *lock)
+{
+    pthread_mutex_unlock(&lock->m);
+}
+
+/* ---------------------------------------------------------------- memory */
+
+#define GFP_KERNEL 0u
+
+#define kmalloc(size, gfp) malloc(size)
+#define kzalloc(size, gfp) calloc(1, (size))
+#define krealloc(ptr, size, gfp) realloc((void *)(ptr), (size))
+#define kcalloc(n, size, gfp) calloc((n), (size))
+#define kvmalloc(size, gfp) malloc(size)
+#define kvcalloc(n, size, gfp) calloc((n), (size))
+#define kfree(ptr) free((void *)(ptr))
+#define kvfree(ptr) free((void *)(ptr))
+
+struct page;
+
+static inline void *vmalloc_user(unsigned long size)
+{
+    void *ptr = NULL;
+
+    if(posix_memalign(&ptr, PAGE_SIZE, size) != 0)
+    {
+        return NULL;
+    }
+    return memset(ptr, 0, size);
+}
+
+#define vfree(ptr) free((void *)(ptr))
+#define vmalloc_to_page(addr) ((struct page *)(addr))
+
+#define SLAB_HWCACHE_ALIGN 0x2000ul
+#define SLAB_TYPESAFE_BY_RCU 0x80000ul
+
+/**
+ * Freed objects stay on the cache's free list until it is destroyed, so
+ * like with SLAB_TYPESAFE_BY_RCU their memory is never handed to anything
+ * but an object of the same cache
+ */
+struct kmem_cache
+{
+    size_t size;
+    pthread_mutex_t lock;
+    void *free;
+};
+
+extern struct kmem_cache *kmem_cache_create(const char *name, unsigned int size, unsigned int align,
+                                            unsigned long flags, void (*ctor)(void *));
+extern void kmem_cache_destroy(struct kmem_cache *cache);
+extern void *kmem_cache_alloc(struct kmem_cache *cache, gfp_t gfp);
+extern void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+static inline unsigned long copy_to_user(void __user *to, const void *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void __user *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ RCU */
+
+struct rcu_head
+{
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+};
+
+/**
+ * Read sections hold a writer preferring rwlock for reading. Callbacks are
+ * queued for a grace period thread, which takes the lock for writing before
+ * it runs them, once no reader can still see what they free.
+ */
+extern pthread_rwlock_t kshim_rcu_lock;
+extern void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head));
+extern void rcu_barrier(void);
+
+static inline void rcu_read_lock(void)
+{
+    pthread_rwlock_rdlock(&kshim_rcu_lock);
+}
+
+static inline void rcu_read_unlock(void)
+{
+    pthread_rwlock_unlock(&kshim_rcu_lock);
+}
+
+/* ------------------------------------------------------------- seqcount */
+
+typedef struct
+{
+    unsigned int sequence;
+} seqcount_mutex_t;
+
+#define seqcount_mutex_init(s, lock) ((s)->sequence = 0)
+
+static inline unsigned int read_seqcount_begin(const seqcount_mutex_t *s)
+{
+    unsigned int seq;
+
+    while(((seq = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE)) & 1) != 0)
+    {
+        sched_yield();
+    }
+    return seq;
+}
+
+static inline int read_seqcount_retry(const seqcount_mutex_t *s, unsigned int start)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&s->sequence, __ATOMIC_RELAXED) != start;
+}
+
+static inline void write_seqcount_begin(seqcount_mutex_t *s)
+{
+    __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void write_seqcount_end(seqcount_mutex_t *s)
+{
+    __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELEASE);
+}
+
+/* ---------------------------------------------------------- wait queues */
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t *wq)
+{
+    pthread_mutex_init(&wq->lock, NULL);
+    pthread_cond_init(&wq->cond, NULL);
+}
+
+static inline void wake_up_interruptible(wait_queue_head_t *wq)
+{
+    pthread_mutex_lock(&wq->lock);
+    pthread_cond_broadcast(&wq->cond);
+    pthread_mutex_unlock(&wq->lock);
+}
+
+// wakers change the condition before they take the lock, so checking it
+// under the lock can not miss a wakeup
+#define wait_event_interruptible(wq, condition) \
+    ({ \
+        pthread_mutex_lock(&(wq).lock); \
+        while(!(condition)) \
+        { \
+            pthread_cond_wait(&(wq).cond, &(wq).lock); \
+        } \
+        pthread_mutex_unlock(&(wq).lock); \
+        0; \
+    })
+
+/* ----------------------------------------------------------------- lists */
+
+struct list_head
+{
+    struct list_head *next;
+    struct list_head *prev;
+};
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+    list->next = list;
+    list->prev = list;
+}
+
+static inline void list_add_tail(struct list_head *entry, struct list_head *head)
+{
+    entry->prev = head->prev;
+    entry->next = head;
+    head->prev->next = entry;
+    head->prev = entry;
+}
+
+static inline void list_del(struct list_head *entry)
+{
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+    return head->next == head;
+}
+
+static inline int list_is_last(const struct list_head *entry, const struct list_head *head)
+{
+    return entry->next == head;
+}
+
+static inline void list_splice_tail_init(struct list_head *list, struct list_head *head)
+{
+    if(list_empty(list))
+    {
+        return;
+    }
+    list->next->prev = head->prev;
+    head->prev->next = list->next;
+    list->prev->next = head;
+    head->prev = list->prev;
+    INIT_LIST_HEAD(list);
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_last_entry(head, type, member) list_entry((head)->prev, type, member)
+#define list_for_each_entry(pos, head, member) \
+    for(pos = list_entry((head)->next, __typeof__(*pos), member); \
+        &pos->member != (head); \
+        pos = list_entry(pos->member.next, __typeof__(*pos), member))
+#define list_for_each_entry_safe(pos, n, head, member) \
+    for(pos = list_entry((head)->next, __typeof__(*pos), member), \
+        n = list_entry(pos->member.next, __typeof__(*pos), member); \
+        &pos->member != (head); \
+        pos = n, n = list_entry(n->member.next, __typeof__(*n), member))
+
+/* ---------------------------------------------------------- files, VFS */
+
+#define MINORBITS 20
+#define MAJOR(dev) ((unsigned int)((dev) >> MINORBITS))
+#define MINOR(dev) ((unsigned int)((dev) & ((1u << MINORBITS) - 1)))
+#define MKDEV(ma, mi) (((dev_t)(ma) << MINORBITS) | (mi))
+
+struct file_operations;
+
+struct cdev
+{
+    struct module *owner;
+    const struct file_operations *ops;
+    dev_t dev;
+};
+
+struct inode
+{
+    struct cdev *i_cdev;
+};
+
+struct file
+{
+    struct inode *f_inode;
+    void *private_data;
+    loff_t f_pos;
+    unsigned int f_flags;
+    fmode_t f_mode;
+};
+
+struct iov_iter
+{
+    const struct iovec *iov;
+    unsigned long nr_segs;
+    size_t iov_offset;
+    size_t count;
+};
+
+#define IOCB_NOWAIT (1 << 7)
+
+struct kiocb
+{
+    struct file *ki_filp;
+    loff_t ki_pos;
+    int ki_flags;
+};
+
+static inline size_t iov_iter_count(const struct iov_iter *iter)
+{
+    return iter->count;
+}
+
+extern size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *iter);
+extern size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *iter);
+
+#define EPOLLIN 0x001
+#define EPOLLOUT 0x004
+#define EPOLLRDNORM 0x040
+#define EPOLLWRNORM 0x100
+
+struct poll_table_struct;
+typedef struct poll_table_struct poll_table;
+
+// there is nothing to sleep in, poll callers just see the current state
+#define poll_wait(filp, wq, table) do { (void)(filp); (void)(wq); (void)(table); } while(0)
+
+#define VM_WRITE 0x2ul
+#define VM_MAYWRITE 0x20ul
+
+struct vm_area_struct
+{
+    unsigned long vm_start;
+    unsigned long vm_end;
+    unsigned long vm_pgoff;
+    unsigned long vm_flags;
+};
+
+static inline unsigned long vma_pages(const struct vm_area_struct *vma)
+{
+    return (vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
+}
+
+static inline void vm_flags_clear(struct vm_area_struct *vma, unsigned long flags)
+{
+    vma->vm_flags &= ~flags;
+}
+
+// mappings are not supported, the pages are only checked for
+static inline int vm_insert_page(struct vm_area_struct *vma, unsigned long addr, struct page *page)
+{
+    (void)vma;
+    (void)addr;
+    return (page != NULL) ? 0 : -EINVAL;
+}
+
+struct pipe_inode_info;
+struct seq_file;
+
+struct file_operations
+{
+    struct module *owner;
+    loff_t (*llseek)(struct file *filp, loff_t off, int whence);
+    ssize_t (*read)(struct file *filp, char __user *buf, size_t count, loff_t *f_pos);
+    ssize_t (*write)(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos);
+    ssize_t (*read_iter)(struct kiocb *iocb, struct iov_iter *to);
+    ssize_t (*write_iter)(struct kiocb *iocb, struct iov_iter *from);
+    __poll_t (*poll)(struct file *filp, poll_table *wait);
+    long (*unlocked_ioctl)(struct file *filp, unsigned int cmd, unsigned long arg);
+    int (*mmap)(struct file *filp, struct vm_area_struct *vma);
+    int (*open)(struct inode *inode, struct file *filp);
+    int (*release)(struct inode *inode, struct file *filp);
+    ssize_t (*splice_read)(struct file *in, loff_t *ppos, struct pipe_inode_info *pipe,
+                           size_t len, unsigned int flags);
+    // shim only: what a seq_file based file prints, see DEFINE_SHOW_ATTRIBUTE
+    int (*show)(struct seq_file *s, void *unused);
+};
+
+extern loff_t fixed_size_llseek(struct file *filp, loff_t off, int whence, loff_t size);
+extern ssize_t copy_splice_read(struct file *in, loff_t *ppos, struct pipe_inode_info *pipe,
+                                size_t len, unsigned int flags);
+
+extern int alloc_chrdev_region(dev_t *dev, unsigned int baseminor, unsigned int count, const char *name);
+extern void unregister_chrdev_region(dev_t dev, unsigned int count);
+extern void cdev_init(struct cdev *cdev, const struct file_operations *fops);
+extern int cdev_add(struct cdev *cdev, dev_t dev, unsigned int count);
+extern void cdev_del(struct cdev *cdev);
+
+/* ----------------------------------------------------------------- time */
+
+static inline u64 ktime_get_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((u64)ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+/* ------------------------------------------------------ debugfs, tracing */
+
+struct dentry;
+
+struct seq_file
+{
+    FILE *out;
+    void *private;
+};
+
+#define seq_printf(s, ...) fprintf((s)->out, __VA_ARGS__)
+#define seq_puts(s, str) fputs((str), (s)->out)
+
+#define DEFINE_SHOW_ATTRIBUTE(name) \
+    static const struct file_operations name##_fops = { \
+        .owner = THIS_MODULE, \
+        .show = name##_show, \
+    }
+
+extern struct dentry *debugfs_create_dir(const char *name, struct dentry *parent);
+extern struct dentry *debugfs_create_file(const char *name, unsigned short mode, struct dentry *parent,
+                                          void *data, const struct file_operations *fops);
+extern void debugfs_remove_recursive(struct dentry *dentry);
+
+// events compile to nothing, calls are still checked against their prototype
+#define TP_PROTO(...) __VA_ARGS__
+#define TP_ARGS(...) __VA_ARGS__
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+    static inline void trace_##name(proto) {}
+
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE KERNEL_VERSION(6, 8, 0)
+
+/* ------------------------------------------------- driver side of kshim */
+
+/**
+ * Set a module parameter from "name=value", or "name=v1,v2" for arrays,
+ * as insmod would before the init function runs
+ * @return 0, or -1 if there is no such parameter or the value is invalid
+ */
+extern int kshim_param_set(const char *arg);
+
+/**
+ * Open the device with minor number @param minor into @param filp through
+ * the file_operations of its cdev, with open flags @param flags
+ * @return the result of the open
+ */
+extern int kshim_open(unsigned int minor, unsigned int flags, struct file *filp);
+
+extern int kshim_release(struct file *filp);
+
+/**
+ * Print the debugfs file at @param path, like "aesdchar/aesdchar0/stats", to @param out
+ * @return 0, or -1 if there is no such file
+ */
+extern int kshim_debugfs_print(const char *path, FILE *out);
+
+#endif /* KSHIM_H */
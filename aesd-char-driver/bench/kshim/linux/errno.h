@@ -0,0 +1,2 @@
+/* the C library reaches the error numbers through here too */
+#include <asm/errno.h>
@@ -0,0 +1 @@
+/* tracepoints are defined by kshim.h, there is nothing to instantiate */
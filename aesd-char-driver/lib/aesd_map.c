@@ -0,0 +1,132 @@
+/**
+ * @file aesd_map.c
+ * @brief Userspace reader of the aesdchar mmap view
+ *
+ * The driver moves tail before it overwrites any byte and moves head after
+ * an entry is complete. Loading head with acquire ordering makes the bytes
+ * before it visible, and loading tail again after the copy tells whether a
+ * writer got to any of them meanwhile.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "aesd_map.h"
+
+int aesd_map_open(struct aesd_map *map, const char *path)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    struct aesd_mmap_header *header;
+
+    memset(map, 0, sizeof(*map));
+    map->fd = open(path, O_RDONLY);
+    if(map->fd == -1)
+    {
+        return -1;
+    }
+
+    // the header tells how large the ring is
+    header = mmap(NULL, page_size, PROT_READ, MAP_SHARED, map->fd, 0);
+    if(header == MAP_FAILED)
+    {
+        goto fail;
+    }
+    if((header->magic != AESD_MMAP_MAGIC) || (header->version != AESD_MMAP_VERSION))
+    {
+        munmap(header, page_size);
+        errno = EPROTO;
+        goto fail;
+    }
+    map->ring_size = header->ring_size;
+    munmap(header, page_size);
+
+    map->length = AESD_MMAP_DATA_OFFSET(page_size) + (2 * map->ring_size);
+    map->base = mmap(NULL, map->length, PROT_READ, MAP_SHARED, map->fd, 0);
+    if(map->base == MAP_FAILED)
+    {
+        map->base = NULL;
+        goto fail;
+    }
+    map->header = map->base;
+    map->data = (const char *)map->base + AESD_MMAP_DATA_OFFSET(page_size);
+    return 0;
+
+fail:
+    close(map->fd);
+    map->fd = -1;
+    return -1;
+}
+
+void aesd_map_close(struct aesd_map *map)
+{
+    if(map->base != NULL)
+    {
+        munmap(map->base, map->length);
+        map->base = NULL;
+    }
+    if(map->fd != -1)
+    {
+        close(map->fd);
+        map->fd = -1;
+    }
+}
+
+uint64_t aesd_map_head(const struct aesd_map *map)
+{
+    return __atomic_load_n(&map->header->head, __ATOMIC_ACQUIRE);
+}
+
+uint64_t aesd_map_tail(const struct aesd_map *map)
+{
+    return __atomic_load_n(&map->header->tail, __ATOMIC_ACQUIRE);
+}
+
+uint64_t aesd_map_seq(const struct aesd_map *map)
+{
+    return __atomic_load_n(&map->header->seq, __ATOMIC_ACQUIRE);
+}
+
+const char *aesd_map_peek(const struct aesd_map *map, uint64_t pos, size_t *len)
+{
+    uint64_t head = aesd_map_head(map);
+
+    if(pos < aesd_map_tail(map))
+    {
+        errno = EOVERFLOW;
+        return NULL;
+    }
+
+    *len = (pos < head) ? (head - pos) : 0;
+    return map->data + (pos & (map->ring_size - 1));
+}
+
+bool aesd_map_intact(const struct aesd_map *map, uint64_t pos)
+{
+    // order the caller's loads of the data before the tail load
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return pos >= __atomic_load_n(&map->header->tail, __ATOMIC_RELAXED);
+}
+
+ssize_t aesd_map_read(const struct aesd_map *map, uint64_t *pos, char *dest, size_t count)
+{
+    const char *src;
+    size_t len;
+
+    src = aesd_map_peek(map, *pos, &len);
+    if(src != NULL)
+    {
+        len = (len < count) ? len : count;
+        memcpy(dest, src, len);
+        if(aesd_map_intact(map, *pos))
+        {
+            *pos += len;
+            return len;
+        }
+    }
+
+    *pos = aesd_map_tail(map);
+    errno = EOVERFLOW;
+    return -1;
+}
@@ -0,0 +1,78 @@
+/**
+ * @file aesd_map.h
+ * @brief Userspace reader of the aesdchar mmap view
+ *
+ * Reads data written to /dev/aesdchar straight from the mapping, with no
+ * syscalls after aesd_map_open(). Positions are stream offsets as described
+ * in aesd_mmap.h. Data older than the ring size is overwritten by later
+ * writes, every read reports when that happened to the range it returns.
+ */
+
+#ifndef AESD_MAP_H
+#define AESD_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "../aesd_mmap.h"
+
+struct aesd_map {
+    int fd;
+    void *base;
+    size_t length;
+    const struct aesd_mmap_header *header;
+    /**
+     * The ring mapped twice, ring_size bytes from any offset are contiguous
+     */
+    const char *data;
+    uint64_t ring_size;
+};
+
+/**
+ * Map the device at @param path into @param map
+ * @return 0, or -1 with errno set
+ */
+extern int aesd_map_open(struct aesd_map *map, const char *path);
+
+extern void aesd_map_close(struct aesd_map *map);
+
+/**
+ * @return the stream offset one past the newest complete entry
+ */
+extern uint64_t aesd_map_head(const struct aesd_map *map);
+
+/**
+ * @return the stream offset of the oldest byte still in the ring
+ */
+extern uint64_t aesd_map_tail(const struct aesd_map *map);
+
+/**
+ * @return the number of entries written since the module was loaded
+ */
+extern uint64_t aesd_map_seq(const struct aesd_map *map);
+
+/**
+ * Zero copy access to the data at @param pos. Sets @param len to the bytes
+ * available up to the head and returns a pointer into the mapping, or NULL
+ * with errno EOVERFLOW if pos was already overwritten. The bytes stay valid
+ * until a writer laps them, check with aesd_map_intact() after using them.
+ */
+extern const char *aesd_map_peek(const struct aesd_map *map, uint64_t pos, size_t *len);
+
+/**
+ * @return true if the data from @param pos on was not overwritten since it
+ * was returned by aesd_map_peek()
+ */
+extern bool aesd_map_intact(const struct aesd_map *map, uint64_t pos);
+
+/**
+ * Copy up to @param count bytes from *@param pos into @param dest and
+ * advance *pos past them.
+ * @return the bytes copied, 0 at the head, or -1 with errno EOVERFLOW if
+ * the data at *pos was overwritten, in which case *pos is moved to the
+ * oldest byte still held so the next read continues from there
+ */
+extern ssize_t aesd_map_read(const struct aesd_map *map, uint64_t *pos, char *dest, size_t count);
+
+#endif /* AESD_MAP_H */
@@ -0,0 +1,45 @@
+/**
+ * @file aesd_map_cat.c
+ * @brief Prints the data held by the aesdchar mmap ring, with no read() calls
+ *
+ * Usage: ./aesd_map_cat [device]
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "aesd_map.h"
+
+int main(int argc, char *argv[])
+{
+    const char *path = (argc > 1) ? argv[1] : "/dev/aesdchar";
+    struct aesd_map map;
+    char buf[4096];
+    uint64_t pos;
+    uint64_t head;
+    ssize_t ret;
+
+    if(aesd_map_open(&map, path) == -1)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    pos = aesd_map_tail(&map);
+    head = aesd_map_head(&map);
+    while(pos < head)
+    {
+        ret = aesd_map_read(&map, &pos, buf, sizeof(buf));
+        if(ret == -1)
+        {
+            // a writer lapped us, carry on from the oldest data
+            fprintf(stderr, "data overwritten, skipping to %llu\n", (unsigned long long)pos);
+            continue;
+        }
+        fwrite(buf, 1, ret, stdout);
+    }
+
+    aesd_map_close(&map);
+    return 0;
+}
@@ -23,49 +23,1244 @@
 #include <linux/types.h>
 #include <linux/cdev.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/list.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
 #include <linux/uaccess.h>
 #include <linux/fs.h>
+#include <linux/uio.h>
+#include <linux/cache.h>
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/bitops.h>
 #include "aesdchar.h"
 #include "aesd_ioctl.h"
+#include "aesd_mmap.h"
+
+#define CREATE_TRACE_POINTS
+#include "aesd-trace.h"
 
 int aesd_major =   0; // use dynamic major
 int aesd_minor =   0;
 
+// upper bound of the devices parameter
+#define AESD_MAX_DEVICES 64
+
+// independent devices, minors 0 to devices - 1
+static uint devices = 1;
+module_param(devices, uint, S_IRUGO);
+MODULE_PARM_DESC(devices, "Number of independent aesdchar devices");
+
+// entries kept, rounded up to a power of two, 0 keeps the default of 10.
+// One value per device, the last value given applies to the devices after it.
+static uint max_entries[AESD_MAX_DEVICES];
+static int max_entries_count = 0;
+module_param_array(max_entries, uint, &max_entries_count, S_IRUGO);
+MODULE_PARM_DESC(max_entries, "Number of writes kept by the circular buffer of each device");
+
+// bytes of entries kept, the oldest are dropped to make room, 0 for no limit.
+// Per device like max_entries. A line longer than the limit fails with EFBIG.
+static ulong max_bytes[AESD_MAX_DEVICES];
+static int max_bytes_count = 0;
+module_param_array(max_bytes, ulong, &max_bytes_count, S_IRUGO);
+MODULE_PARM_DESC(max_bytes, "Bytes of entries kept by the circular buffer of each device, 0 for no limit");
+
+// what a write does when making room would drop entries a following reader
+// has not read, an AESD_POLICY_* value. Per device like max_entries.
+static uint full_policy[AESD_MAX_DEVICES];
+static int full_policy_count = 0;
+module_param_array(full_policy, uint, &full_policy_count, S_IRUGO);
+MODULE_PARM_DESC(full_policy, "When followers are behind: 0 overwrites, 1 blocks writers, 2 fails them with EAGAIN");
+
+// bytes of written data readable through mmap, rounded up to a power of two, 0 disables mmap
+static uint mmap_size = 64 * 1024;
+module_param(mmap_size, uint, S_IRUGO);
+MODULE_PARM_DESC(mmap_size, "Size of the data ring mapped by mmap, 0 to disable");
+
+// largest copy a lockless read makes before handing data to userspace
+#define AESD_READ_CHUNK (64 * 1024)
+// snapshot attempts a read makes before waiting for writers on the lock
+#define AESD_READ_RETRIES 8
+// lines of one write tracked without an allocation
+#define AESD_WRITE_LINES 8
+
 MODULE_AUTHOR("Amey More");
 MODULE_LICENSE("Dual BSD/GPL");
 
-struct aesd_dev aesd_device;
+// devices entries, each on its own cache lines
+struct aesd_dev *aesd_devices;
+
+// entry buffers of the size classes, shared by all devices
+static struct kmem_cache *aesd_entry_caches[AESD_ENTRY_CLASSES];
+static const char * const aesd_entry_cache_names[AESD_ENTRY_CLASSES] = {
+    "aesd_entry_64", "aesd_entry_128", "aesd_entry_256",
+    "aesd_entry_512", "aesd_entry_1k", "aesd_entry_2k",
+};
+
+static struct dentry *aesd_debugfs;
+
+#define aesd_stat_add(dev, field, value) this_cpu_add((dev)->stats->field, (value))
+#define aesd_stat_inc(dev, field) this_cpu_inc((dev)->stats->field)
+
+static unsigned int aesd_latency_bucket(u64 ns)
+{
+    return min_t(unsigned int, fls64(ns), AESD_LATENCY_BUCKETS - 1);
+}
+
+/**
+ * Take dev->lock, timing the wait only when it is contended
+ */
+static void aesd_dev_lock(struct aesd_dev *dev)
+{
+    u64 start = 0;
+    u64 wait_ns = 0;
+
+    if (mutex_trylock(&dev->lock))
+    {
+        return;
+    }
+    start = ktime_get_ns();
+    mutex_lock(&dev->lock);
+    wait_ns = ktime_get_ns() - start;
+    aesd_stat_inc(dev, lock_waits);
+    aesd_stat_add(dev, lock_wait_ns, wait_ns);
+    trace_aesd_lock_wait(MINOR(dev->cdev.dev), wait_ns);
+}
+
+/**
+ * @return the smallest size class holding len bytes of data,
+ * AESD_ENTRY_CLASSES if the entry is too large for any
+ */
+static unsigned int aesd_entry_class(size_t len)
+{
+    unsigned int c = 0;
+
+    while ((c < AESD_ENTRY_CLASSES) &&
+           (offsetof(struct aesd_entry_buf, data) + len > AESD_ENTRY_CLASS_SIZE(c)))
+    {
+        c++;
+    }
+    return c;
+}
+
+/**
+ * A buffer for an entry of len bytes on dev, the buffer of an entry of the
+ * same size class dev overwrote last if there is one
+ */
+static char *aesd_entry_alloc(struct aesd_dev *dev, size_t len)
+{
+    struct aesd_alloc_stats *stats = &dev->alloc_stats;
+    struct aesd_entry_buf *buf = NULL;
+    unsigned int c = aesd_entry_class(len);
+    u64 start = 0;
+    u64 ns = 0;
+
+    if (c < AESD_ENTRY_CLASSES)
+    {
+        buf = xchg(&dev->spare[c], NULL);
+        if (buf != NULL)
+        {
+            atomic64_inc(&stats->recycled[c]);
+            return buf->data;
+        }
+    }
+
+    start = ktime_get_ns();
+    if (c < AESD_ENTRY_CLASSES)
+    {
+        buf = kmem_cache_alloc(aesd_entry_caches[c], GFP_KERNEL);
+    }
+    else
+    {
+        buf = kvmalloc(sizeof(struct aesd_entry_buf) + len, GFP_KERNEL);
+    }
+    if (buf == NULL)
+    {
+        return NULL;
+    }
+    ns = ktime_get_ns() - start;
+
+    atomic64_inc(&stats->allocs[c]);
+    atomic64_add(ns, &stats->alloc_ns[c]);
+    if (ns > READ_ONCE(stats->alloc_ns_max[c]))
+    {
+        WRITE_ONCE(stats->alloc_ns_max[c], ns);
+    }
+    buf->size_class = c;
+    return buf->data;
+}
+
+static void aesd_entry_buf_free(struct aesd_entry_buf *buf)
+{
+    if (buf->size_class < AESD_ENTRY_CLASSES)
+    {
+        kmem_cache_free(aesd_entry_caches[buf->size_class], buf);
+    }
+    else
+    {
+        kvfree(buf);
+    }
+}
+
+static void aesd_entry_free(const char *buffptr)
+{
+    if (buffptr != NULL)
+    {
+        aesd_entry_buf_free(container_of(buffptr, struct aesd_entry_buf, data[0]));
+    }
+}
+
+static void aesd_entry_free_rcu(struct rcu_head *rcu)
+{
+    kvfree(container_of(rcu, struct aesd_entry_buf, rcu));
+}
+
+/**
+ * Give back the buffer of an entry dev overwrote. A size class buffer
+ * becomes the spare of dev for the next write of its class, or goes back
+ * to its cache if there is a spare already. A kvmalloc'd buffer is freed
+ * once every reader that might still be copying from it has left its RCU
+ * read section.
+ */
+static void aesd_entry_recycle(struct aesd_dev *dev, const char *buffptr)
+{
+    struct aesd_entry_buf *buf;
+
+    if (buffptr == NULL)
+    {
+        return;
+    }
+
+    buf = container_of(buffptr, struct aesd_entry_buf, data[0]);
+    if (buf->size_class == AESD_ENTRY_CLASSES)
+    {
+        call_rcu(&buf->rcu, aesd_entry_free_rcu);
+    }
+    else if (cmpxchg(&dev->spare[buf->size_class], NULL, buf) != NULL)
+    {
+        kmem_cache_free(aesd_entry_caches[buf->size_class], buf);
+    }
+}
+
+/**
+ * Allocation counters of a device, by size class
+ */
+static int aesd_alloc_show(struct seq_file *s, void *unused)
+{
+    struct aesd_alloc_stats *stats = s->private;
+    unsigned int c = 0;
+    u64 allocs = 0;
+
+    seq_printf(s, "%-8s %12s %12s %12s %12s\n", "class", "allocs", "recycled", "avg_ns", "max_ns");
+    for (c = 0; c <= AESD_ENTRY_CLASSES; c++)
+    {
+        allocs = atomic64_read(&stats->allocs[c]);
+        if (c < AESD_ENTRY_CLASSES)
+        {
+            seq_printf(s, "%-8u", AESD_ENTRY_CLASS_SIZE(c));
+        }
+        else
+        {
+            seq_printf(s, "%-8s", "large");
+        }
+        seq_printf(s, " %12llu %12llu %12llu %12llu\n", allocs,
+                   atomic64_read(&stats->recycled[c]),
+                   allocs ? (u64)atomic64_read(&stats->alloc_ns[c]) / allocs : 0,
+                   READ_ONCE(stats->alloc_ns_max[c]));
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(aesd_alloc);
+
+/**
+ * Sum of the per CPU counters of a device, the histograms left out
+ */
+static void aesd_stats_sum(struct aesd_dev *dev, struct aesd_stats *sum)
+{
+    struct aesd_stats *cpu_stats = NULL;
+    int cpu = 0;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu(cpu)
+    {
+        cpu_stats = per_cpu_ptr(dev->stats, cpu);
+        sum->reads += cpu_stats->reads;
+        sum->read_bytes += cpu_stats->read_bytes;
+        sum->writes += cpu_stats->writes;
+        sum->write_bytes += cpu_stats->write_bytes;
+        sum->overwrites += cpu_stats->overwrites;
+        sum->seeks += cpu_stats->seeks;
+        sum->lock_waits += cpu_stats->lock_waits;
+        sum->lock_wait_ns += cpu_stats->lock_wait_ns;
+        sum->staged_bytes += cpu_stats->staged_bytes;
+    }
+}
+
+static int aesd_stats_show(struct seq_file *s, void *unused)
+{
+    struct aesd_stats sum;
+
+    aesd_stats_sum(s->private, &sum);
+    seq_printf(s, "reads %llu\n", sum.reads);
+    seq_printf(s, "read_bytes %llu\n", sum.read_bytes);
+    seq_printf(s, "writes %llu\n", sum.writes);
+    seq_printf(s, "write_bytes %llu\n", sum.write_bytes);
+    seq_printf(s, "overwrites %llu\n", sum.overwrites);
+    seq_printf(s, "seeks %llu\n", sum.seeks);
+    seq_printf(s, "lock_waits %llu\n", sum.lock_waits);
+    seq_printf(s, "lock_wait_ns %llu\n", sum.lock_wait_ns);
+    seq_printf(s, "staged_bytes %lld\n", sum.staged_bytes);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(aesd_stats);
+
+/**
+ * Read and write latency histograms of a device, a row for every bucket
+ * up to the last one used: times below the first column, in ns
+ */
+static int aesd_latency_show(struct seq_file *s, void *unused)
+{
+    struct aesd_dev *dev = s->private;
+    struct aesd_stats *cpu_stats = NULL;
+    u64 reads[AESD_LATENCY_BUCKETS] = { 0 };
+    u64 writes[AESD_LATENCY_BUCKETS] = { 0 };
+    unsigned int b = 0;
+    unsigned int last = 0;
+    int cpu = 0;
+
+    for_each_possible_cpu(cpu)
+    {
+        cpu_stats = per_cpu_ptr(dev->stats, cpu);
+        for (b = 0; b < AESD_LATENCY_BUCKETS; b++)
+        {
+            reads[b] += cpu_stats->read_latency[b];
+            writes[b] += cpu_stats->write_latency[b];
+        }
+    }
+    for (b = 0; b < AESD_LATENCY_BUCKETS; b++)
+    {
+        if ((reads[b] != 0) || (writes[b] != 0))
+        {
+            last = b;
+        }
+    }
+
+    seq_printf(s, "%-12s %12s %12s\n", "ns_below", "reads", "writes");
+    for (b = 0; b <= last; b++)
+    {
+        if (b == AESD_LATENCY_BUCKETS - 1)
+        {
+            seq_printf(s, "%-12s %12llu %12llu\n", "inf", reads[b], writes[b]);
+        }
+        else
+        {
+            seq_printf(s, "%-12llu %12llu %12llu\n", 1ull << b, reads[b], writes[b]);
+        }
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(aesd_latency);
+
+static void aesd_stage_init(struct aesd_stage *stage)
+{
+    INIT_LIST_HEAD(&stage->chunks);
+    stage->size = 0;
+}
+
+static void aesd_stage_free(struct aesd_stage *stage)
+{
+    struct aesd_stage_chunk *chunk, *next;
+
+    list_for_each_entry_safe(chunk, next, &stage->chunks, list)
+    {
+        list_del(&chunk->list);
+        kfree(chunk);
+    }
+    stage->size = 0;
+}
+
+/**
+ * @return the last chunk of stage if it has room, else a new empty one
+ * added to the end, NULL if that allocation fails
+ */
+static struct aesd_stage_chunk *aesd_stage_tail(struct aesd_stage *stage)
+{
+    struct aesd_stage_chunk *chunk = NULL;
+
+    if (!list_empty(&stage->chunks))
+    {
+        chunk = list_last_entry(&stage->chunks, struct aesd_stage_chunk, list);
+        if (chunk->used < AESD_STAGE_CHUNK_DATA)
+        {
+            return chunk;
+        }
+    }
+
+    chunk = kmalloc(PAGE_SIZE, GFP_KERNEL);
+    if (chunk != NULL)
+    {
+        chunk->head = 0;
+        chunk->used = 0;
+        list_add_tail(&chunk->list, &stage->chunks);
+    }
+    return chunk;
+}
+
+/**
+ * Move the first len bytes of stage into one entry buffer of dev. Taken
+ * bytes are skipped, not moved, so the rest of a chunk stays where it is
+ * for the next entry, and a chunk is only freed or reused once empty.
+ * @return the buffer, NULL if it could not be allocated
+ */
+static char *aesd_stage_take(struct aesd_dev *dev, struct aesd_stage *stage, size_t len)
+{
+    struct aesd_stage_chunk *chunk, *next;
+    char *buffptr;
+    size_t copied = 0;
+    size_t bytes;
+
+    buffptr = aesd_entry_alloc(dev, len);
+    if (buffptr == NULL)
+    {
+        PDEBUG("aesd_entry_alloc() error");
+        return NULL;
+    }
+
+    list_for_each_entry_safe(chunk, next, &stage->chunks, list)
+    {
+        if (copied == len)
+        {
+            break;
+        }
+        bytes = min(len - copied, chunk->used - chunk->head);
+        memcpy(buffptr + copied, chunk->data + chunk->head, bytes);
+        copied += bytes;
+        chunk->head += bytes;
+        if (chunk->head < chunk->used)
+        {
+            continue;
+        }
+
+        // keep the last chunk for the bytes written next
+        if (list_is_last(&chunk->list, &stage->chunks))
+        {
+            chunk->head = 0;
+            chunk->used = 0;
+        }
+        else
+        {
+            list_del(&chunk->list);
+            kfree(chunk);
+        }
+    }
+    stage->size -= len;
+    aesd_stat_add(dev, staged_bytes, -(s64)len);
+
+    return buffptr;
+}
+
+/**
+ * Move every staged byte of from to the end of to
+ */
+static void aesd_stage_splice(struct aesd_stage *from, struct aesd_stage *to)
+{
+    list_splice_tail_init(&from->chunks, &to->chunks);
+    to->size += from->size;
+    from->size = 0;
+}
+
+/**
+ * Drop staged bytes from the end of stage until size are left, keeping the
+ * last chunk for the bytes written next
+ */
+static void aesd_stage_truncate(struct aesd_dev *dev, struct aesd_stage *stage, size_t size)
+{
+    struct aesd_stage_chunk *chunk = NULL;
+    size_t excess = stage->size - size;
+    size_t bytes = 0;
+
+    aesd_stat_add(dev, staged_bytes, -(s64)excess);
+    stage->size = size;
+    while (excess != 0)
+    {
+        chunk = list_last_entry(&stage->chunks, struct aesd_stage_chunk, list);
+        bytes = min(excess, chunk->used - chunk->head);
+        chunk->used -= bytes;
+        excess -= bytes;
+        // an emptied chunk goes unless it is the only one left
+        if ((chunk->used == chunk->head) && (chunk->list.prev != &stage->chunks))
+        {
+            list_del(&chunk->list);
+            kfree(chunk);
+        }
+    }
+}
+
+/**
+ * Copy a complete entry into the mmap ring. Caller must hold dev->lock.
+ * Ordering follows aesd_mmap.h: tail first, then the bytes, then head.
+ */
+static void aesd_mmap_append(struct aesd_dev *dev, const char *buffptr, size_t len)
+{
+    struct aesd_mmap_header *header = dev->mmap_header;
+    uint64_t size = 0;
+    uint64_t start = 0;
+    size_t pos = 0;
+    size_t bytes = 0;
+
+    if (header == NULL)
+    {
+        return;
+    }
+
+    // only the end of an entry larger than the ring is kept
+    size = header->ring_size;
+    start = header->head;
+    if (len > size)
+    {
+        buffptr += len - size;
+        start += len - size;
+        len = size;
+    }
+
+    if ((start + len - header->tail) > size)
+    {
+        WRITE_ONCE(header->tail, start + len - size);
+    }
+    smp_wmb();
+
+    pos = start & (size - 1);
+    bytes = min_t(size_t, len, size - pos);
+    memcpy(dev->mmap_ring + pos, buffptr, bytes);
+    memcpy(dev->mmap_ring, buffptr + bytes, len - bytes);
+    smp_wmb();
+
+    WRITE_ONCE(header->seq, header->seq + 1);
+    WRITE_ONCE(header->head, start + len);
+}
+
+/**
+ * Drop the oldest entry of dev to make room for the next one, reusing or
+ * freeing its buffer. Caller must hold dev->lock inside a dev->seq write section.
+ */
+static void aesd_drop_oldest_locked(struct aesd_dev *dev)
+{
+    struct aesd_circular_buffer *buffer = &dev->buffer;
+
+    trace_aesd_overwrite(MINOR(dev->cdev.dev), dev->records - aesd_circular_buffer_count(buffer),
+                         aesd_circular_buffer_entry_at(buffer, 0)->size, dev->records);
+    aesd_entry_recycle(dev, aesd_circular_buffer_remove_oldest(buffer));
+    aesd_stat_inc(dev, overwrites);
+}
+
+/**
+ * Add a complete entry to the buffer and the mmap ring.
+ * Caller must hold dev->lock inside a dev->seq write section.
+ * @return the index of the entry
+ */
+static u64 aesd_add_entry_locked(struct aesd_dev *dev, const char *buffptr, size_t len)
+{
+    struct aesd_buffer_entry entry;
+
+    entry.buffptr = buffptr;
+    entry.size = len;
+    entry.timestamp = ktime_get_ns();
+
+    // make room under the byte limit, callers cap len at it but an entry
+    // larger than the limit must still stop once the buffer is empty
+    while ((dev->max_bytes != 0) && (aesd_circular_buffer_count(&dev->buffer) != 0) &&
+           (aesd_circular_buffer_size(&dev->buffer) + len > dev->max_bytes))
+    {
+        aesd_drop_oldest_locked(dev);
+    }
+    // and in the slots, so add_entry has nothing left to overwrite
+    if (dev->buffer.full)
+    {
+        aesd_drop_oldest_locked(dev);
+    }
+    aesd_circular_buffer_add_entry(&dev->buffer, &entry);
+    aesd_mmap_append(dev, buffptr, len);
+
+    return dev->records++;
+}
+
+/**
+ * @return the index of the entry at free running buffer index index,
+ * dev->records counts with dev->buffer.in_offs
+ */
+static inline u64 aesd_entry_seq(struct aesd_dev *dev, uint32_t index)
+{
+    return dev->records - (uint32_t)(dev->buffer.in_offs - index);
+}
+
+/**
+ * @return how many of the oldest entries adding entries entries of bytes bytes
+ * in total drops, more than are held if they can never fit.
+ * Caller must hold dev->lock.
+ */
+static uint32_t aesd_drops_needed_locked(struct aesd_dev *dev, uint32_t entries, size_t bytes)
+{
+    struct aesd_circular_buffer *buffer = &dev->buffer;
+    uint32_t count = aesd_circular_buffer_count(buffer);
+    size_t size = aesd_circular_buffer_size(buffer);
+    uint32_t drops = 0;
+
+    if ((entries > buffer->capacity) || ((dev->max_bytes != 0) && (bytes > dev->max_bytes)))
+    {
+        return count + 1;
+    }
+    // the same entries aesd_add_entry_locked() drops, oldest first
+    while ((count - drops + entries > buffer->capacity) ||
+           ((dev->max_bytes != 0) && (size + bytes > dev->max_bytes)))
+    {
+        size -= aesd_circular_buffer_entry_at(buffer, drops)->size;
+        drops++;
+    }
+    return drops;
+}
+
+/**
+ * @return 0 if adding entries entries of bytes bytes drops nothing a follower
+ * has not read, -EAGAIN if it would, -EFBIG if they can never fit without
+ * dropping each other. Always 0 under AESD_POLICY_OVERWRITE.
+ * Caller must hold dev->lock.
+ */
+static int aesd_check_room_locked(struct aesd_dev *dev, uint32_t entries, size_t bytes)
+{
+    struct aesd_file *file = NULL;
+    uint32_t count = aesd_circular_buffer_count(&dev->buffer);
+    uint32_t drops = 0;
+    u64 unread = dev->records;
+
+    if (dev->policy == AESD_POLICY_OVERWRITE)
+    {
+        return 0;
+    }
+
+    drops = aesd_drops_needed_locked(dev, entries, bytes);
+    if (drops > count)
+    {
+        return -EFBIG;
+    }
+    list_for_each_entry(file, &dev->followers, follower)
+    {
+        unread = min(unread, file->read_seq);
+    }
+    // the oldest entry has index records - count
+    return (dev->records - count + drops <= unread) ? 0 : -EAGAIN;
+}
+
+/**
+ * Wait until adding entries entries of bytes bytes drops nothing a follower
+ * has not read, as the device policy says. Caller must hold dev->lock, which
+ * is dropped while waiting and held again on return.
+ * @return 0 if there is room now, a negative error otherwise
+ */
+static int aesd_wait_room_locked(struct aesd_dev *dev, uint32_t entries, size_t bytes, bool nonblock)
+{
+    int retval = 0;
+    u64 events = 0;
+
+    while ((retval = aesd_check_room_locked(dev, entries, bytes)) == -EAGAIN)
+    {
+        if (nonblock || (dev->policy != AESD_POLICY_BLOCK))
+        {
+            break;
+        }
+
+        events = dev->room_events;
+        mutex_unlock(&dev->lock);
+        if (wait_event_interruptible(dev->room, READ_ONCE(dev->room_events) != events) != 0)
+        {
+            retval = -ERESTARTSYS;
+            aesd_dev_lock(dev);
+            break;
+        }
+        aesd_dev_lock(dev);
+    }
+    return retval;
+}
+
+/**
+ * Writers waiting for room check again. Caller must hold dev->lock.
+ */
+static void aesd_room_changed_locked(struct aesd_dev *dev)
+{
+    WRITE_ONCE(dev->room_events, dev->room_events + 1);
+    wake_up_interruptible(&dev->room);
+}
+
+/**
+ * A finished line of a write, staged until it is committed
+ */
+struct aesd_line
+{
+    size_t len;
+    char *buffptr;
+};
+
+/**
+ * Commit the first lines lines staged in stage, of the lengths in line, as
+ * entries under one acquisition of the device lock, so readers see all of
+ * them or none. Unless the policy is to overwrite, room is checked for all of
+ * them at once, and if that would fail only as many as there is room for go in.
+ * @return the number of lines committed, a negative error if none was.
+ * Lines not committed stay staged.
+ */
+static int aesd_commit_lines(struct aesd_dev *dev, struct aesd_stage *stage, struct aesd_line *line,
+                             unsigned int lines, bool nonblock)
+{
+    int retval = 0;
+    unsigned int taken = 0;
+    unsigned int i = 0;
+    size_t bytes = 0;
+
+    if (READ_ONCE(dev->policy) == AESD_POLICY_OVERWRITE)
+    {
+        // no room to wait for, copy the lines out before taking the lock
+        for (taken = 0; taken < lines; taken++)
+        {
+            line[taken].buffptr = aesd_stage_take(dev, stage, line[taken].len);
+            if (line[taken].buffptr == NULL)
+            {
+                retval = -ENOMEM;
+                break;
+            }
+        }
+        aesd_dev_lock(dev);
+    }
+    else
+    {
+        for (i = 0; i < lines; i++)
+        {
+            bytes += line[i].len;
+        }
+        aesd_dev_lock(dev);
+        // the most lines aesd_check_room_locked() does not refuse with -EFBIG
+        while ((lines > dev->buffer.capacity) || ((dev->max_bytes != 0) && (bytes > dev->max_bytes)))
+        {
+            lines--;
+            bytes -= line[lines].len;
+        }
+        retval = (lines != 0) ? aesd_wait_room_locked(dev, lines, bytes, nonblock) : -EFBIG;
+        // not waiting for room for all of them, take the lines there is room for now
+        while ((retval == -EAGAIN) && (lines > 1))
+        {
+            lines--;
+            bytes -= line[lines].len;
+            retval = aesd_check_room_locked(dev, lines, bytes);
+        }
+        for (taken = 0; (retval == 0) && (taken < lines); taken++)
+        {
+            line[taken].buffptr = aesd_stage_take(dev, stage, line[taken].len);
+            if (line[taken].buffptr == NULL)
+            {
+                retval = -ENOMEM;
+                break;
+            }
+        }
+    }
+
+    if (taken != 0)
+    {
+        write_seqcount_begin(&dev->seq);
+        for (i = 0; i < taken; i++)
+        {
+            aesd_add_entry_locked(dev, line[i].buffptr, line[i].len);
+        }
+        write_seqcount_end(&dev->seq);
+    }
+    mutex_unlock(&dev->lock);
+
+    if (taken == 0)
+    {
+        return retval;
+    }
+    // readers following the device have new data
+    wake_up_interruptible(&dev->wait);
+    return taken;
+}
+
+/**
+ * Start or stop following the device from f_pos. A follower's read_seq
+ * holds back writers until it has read what is at f_pos and after.
+ */
+static void aesd_file_set_follow(struct aesd_file *file, loff_t f_pos, bool follow)
+{
+    struct aesd_dev *dev = file->dev;
+    struct aesd_buffer_entry *entry = NULL;
+    size_t entry_offset = 0;
+
+    mutex_lock(&file->read_lock);
+    aesd_dev_lock(dev);
+    if (follow && !file->follow)
+    {
+        // the cursor keeps the file's place in the data from now on
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, f_pos, &entry_offset);
+        if (entry != NULL)
+        {
+            file->cursor.index = aesd_circular_buffer_entry_index(&dev->buffer, entry);
+            file->cursor.offset = entry_offset;
+        }
+        else
+        {
+            file->cursor.index = dev->buffer.in_offs;
+            file->cursor.offset = 0;
+        }
+        file->cursor.fpos = min_t(loff_t, f_pos, aesd_circular_buffer_size(&dev->buffer));
+        file->cursor.generation = dev->buffer.generation;
+        file->read_seq = aesd_entry_seq(dev, file->cursor.index);
+        list_add_tail(&file->follower, &dev->followers);
+    }
+    else if (!follow && file->follow)
+    {
+        list_del(&file->follower);
+        aesd_room_changed_locked(dev);
+    }
+    WRITE_ONCE(file->follow, follow);
+    mutex_unlock(&dev->lock);
+    mutex_unlock(&file->read_lock);
+
+    // readers waiting at the end stop if follow was cleared
+    wake_up_interruptible(&dev->wait);
+}
+
+/**
+ * Record that the next entry a follower reads is entry index read_seq,
+ * after a read or a seek. Caller must hold file->read_lock.
+ */
+static void aesd_file_advance(struct aesd_file *file, u64 read_seq)
+{
+    struct aesd_dev *dev = file->dev;
+
+    if (!READ_ONCE(file->follow) || (read_seq == file->read_seq))
+    {
+        return;
+    }
+    // under the device lock, so a writer that found no room sees the change
+    aesd_dev_lock(dev);
+    file->read_seq = read_seq;
+    aesd_room_changed_locked(dev);
+    mutex_unlock(&dev->lock);
+}
 
 int aesd_open(struct inode *inode, struct file *filp)
 {
-    struct aesd_dev *dev = NULL;
+    struct aesd_file *file = NULL;
     PDEBUG("open");
     /**
      * handle open
      */
-    dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
-    filp->private_data = dev; 
+    file = kzalloc(sizeof(struct aesd_file), GFP_KERNEL);
+    if (file == NULL)
+    {
+        return -ENOMEM;
+    }
+    file->dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
+    // no read yet, the cursor is invalid until the first lookup
+    file->cursor.fpos = -1;
+    mutex_init(&file->read_lock);
+    aesd_stage_init(&file->stage);
+    mutex_init(&file->write_lock);
+    filp->private_data = file; 
     return 0;
 }
 
 int aesd_release(struct inode *inode, struct file *filp)
 {
+    struct aesd_file *file = filp->private_data;
     PDEBUG("release");
     /**
      * handle release
      */
+    // a line left unfinished is continued by the next writer, as before
+    // partial writes were kept per file
+    if (file->stage.size != 0)
+    {
+        aesd_dev_lock(file->dev);
+        aesd_stage_splice(&file->stage, &file->dev->stage);
+        mutex_unlock(&file->dev->lock);
+    }
+    aesd_stage_free(&file->stage);
+    if (file->follow)
+    {
+        aesd_file_set_follow(file, 0, false);
+    }
+    mutex_destroy(&file->write_lock);
+    mutex_destroy(&file->read_lock);
+    kfree(file);
     filp->private_data = NULL; 
     return 0;
 }
 
+/**
+ * Point cursor at f_pos, keeping it as is when the read is sequential
+ * and the buffer has not overwritten anything since.
+ * Caller must hold dev->lock or be inside a dev->seq read section.
+ * @return false if f_pos is past the end of the buffer
+ */
+static bool aesd_cursor_seek(struct aesd_circular_buffer *buffer, struct aesd_cursor *cursor, loff_t f_pos)
+{
+    struct aesd_buffer_entry *entry = NULL;
+    size_t entry_offset = 0;
+
+    // a cursor at the end continues with the entry written at that index
+    if ((cursor->fpos == f_pos) && (cursor->generation == buffer->generation))
+    {
+        return true;
+    }
+
+    entry = aesd_circular_buffer_find_entry_offset_for_fpos(buffer, f_pos, &entry_offset);
+    if (entry == NULL)
+    {
+        return false;
+    }
+
+    cursor->index = aesd_circular_buffer_entry_index(buffer, entry);
+    cursor->offset = entry_offset;
+    cursor->fpos = f_pos;
+    cursor->generation = buffer->generation;
+    return true;
+}
+
+/**
+ * A following reader keeps its place in the data when older entries are
+ * overwritten, where a plain read keeps its file position.
+ * Caller must hold dev->lock or be inside a dev->seq read section.
+ * @return the file position the cursor moved to, 0 if its entry is gone too
+ */
+static loff_t aesd_cursor_follow(struct aesd_circular_buffer *buffer, struct aesd_cursor *cursor, loff_t f_pos)
+{
+    uint32_t out_offs = buffer->out_offs;
+    uint32_t n = cursor->index - out_offs;
+    // sampled once, the count may change under a dev->seq reader
+    uint32_t count = buffer->in_offs - out_offs;
+
+    if ((cursor->fpos != f_pos) || (cursor->generation == buffer->generation))
+    {
+        return f_pos;
+    }
+
+    if (n > count)
+    {
+        // overwritten before it was read, resume at the oldest entry
+        cursor->fpos = -1;
+        return 0;
+    }
+
+    if (n == count)
+    {
+        cursor->fpos = aesd_circular_buffer_size(buffer);
+    }
+    else
+    {
+        cursor->fpos = aesd_circular_buffer_entry_fpos(buffer, &buffer->entry[cursor->index & buffer->mask])
+                       + cursor->offset;
+    }
+    cursor->generation = buffer->generation;
+    return cursor->fpos;
+}
+
+/**
+ * @return true if a read at f_pos would return data now. Reads the cursor
+ * without read_lock, so with several readers on one file it is a hint.
+ */
+static bool aesd_file_readable(struct aesd_file *file, loff_t f_pos)
+{
+    struct aesd_dev *dev = file->dev;
+    struct aesd_cursor cursor;
+    unsigned int seq = 0;
+    bool readable = false;
+
+    do
+    {
+        seq = read_seqcount_begin(&dev->seq);
+        cursor = file->cursor;
+        if (file->follow)
+        {
+            f_pos = aesd_cursor_follow(&dev->buffer, &cursor, f_pos);
+        }
+        readable = (f_pos < aesd_circular_buffer_size(&dev->buffer));
+    }while (read_seqcount_retry(&dev->seq, seq));
+
+    return readable;
+}
+
+/**
+ * A copy out of the buffer made without the device lock
+ */
+struct aesd_snapshot
+{
+    struct aesd_dev *dev;
+    unsigned int seq;
+    char *bounce;
+};
+
+static size_t aesd_copy_to_bounce(void *ctx, size_t dest_offset, const char *src, size_t bytes)
+{
+    struct aesd_snapshot *snap = ctx;
+
+    // the entry fields behind src and bytes are only consistent if no
+    // writer has started since the snapshot began, stop the copy if one has
+    if ((src == NULL) || read_seqcount_retry(&snap->dev->seq, snap->seq))
+    {
+        return 0;
+    }
+    memcpy(snap->bounce + dest_offset, src, bytes);
+    return bytes;
+}
+
+/**
+ * Where a read or write copies to or from: a plain user buffer for
+ * read()/write(), an iov_iter for read_iter()/write_iter()
+ */
+struct aesd_io
+{
+    char __user *to;
+    const char __user *from;
+    struct iov_iter *iter;
+    bool fault;
+};
+
+typedef size_t (*aesd_copy_in_fn)(void *ctx, size_t src_offset, char *dest, size_t bytes);
+
+static size_t aesd_copy_to_user(void *ctx, size_t dest_offset, const char *src, size_t bytes)
+{
+    struct aesd_io *io = ctx;
+    size_t not_copied;
+
+    not_copied = copy_to_user(io->to + dest_offset, src, bytes);
+    if (not_copied != 0)
+    {
+        PDEBUG("copy_to_user() error retval=%zu", not_copied);
+        io->fault = true;
+    }
+    return bytes - not_copied;
+}
+
+static size_t aesd_copy_to_iter(void *ctx, size_t dest_offset, const char *src, size_t bytes)
+{
+    struct aesd_io *io = ctx;
+    size_t copied;
+
+    // the iterator keeps its own position, dest_offset is implied
+    copied = copy_to_iter(src, bytes, io->iter);
+    if (copied != bytes)
+    {
+        PDEBUG("copy_to_iter() error copied=%zu", copied);
+        io->fault = true;
+    }
+    return copied;
+}
+
+static size_t aesd_copy_from_user(void *ctx, size_t src_offset, char *dest, size_t bytes)
+{
+    struct aesd_io *io = ctx;
+    size_t not_copied;
+
+    not_copied = copy_from_user(dest, io->from + src_offset, bytes);
+    if (not_copied != 0)
+    {
+        PDEBUG("copy_from_user() error retval=%zu", not_copied);
+        io->fault = true;
+    }
+    return bytes - not_copied;
+}
+
+static size_t aesd_copy_from_iter(void *ctx, size_t src_offset, char *dest, size_t bytes)
+{
+    struct aesd_io *io = ctx;
+    size_t copied;
+
+    copied = copy_from_iter(dest, bytes, io->iter);
+    if (copied != bytes)
+    {
+        PDEBUG("copy_from_iter() error copied=%zu", copied);
+        io->fault = true;
+    }
+    return copied;
+}
+
+/**
+ * Copy up to count bytes from *f_pos on, across entries, with copy.
+ * Data is copied to a bounce buffer without the device lock and handed
+ * to copy once the snapshot is known to be consistent.
+ * @return 0 at the end of the data, never waits for more
+ */
+static ssize_t aesd_read_available(struct aesd_file *file, loff_t *f_pos, size_t count,
+                aesd_circular_buffer_copy_fn copy, struct aesd_io *io)
+{
+    ssize_t retval = 0;
+    struct aesd_dev *dev = file->dev;
+    struct aesd_snapshot snap = { .dev = dev };
+    struct aesd_cursor cursor;
+    loff_t pos = 0;
+    size_t chunk = 0;
+    size_t bytes = 0;
+    size_t done = 0;
+    int tries = 0;
+    bool locked = false;
+    u64 start = 0;
+    u64 ns = 0;
+    u64 next_seq = 0;
+    u64 read_seq = 0;
+    bool advanced = false;
+    loff_t start_pos = *f_pos;
+
+    if (count == 0)
+    {
+        return 0;
+    }
+    start = ktime_get_ns();
+
+    // acquire lock, readers of other files do not wait on it
+    if (mutex_lock_interruptible(&file->read_lock) != 0)
+    {
+        PDEBUG("mutex_lock_interruptible() acquiring lock error");
+        return -ERESTARTSYS;
+    }
+
+    snap.bounce = kvmalloc(min_t(size_t, count, AESD_READ_CHUNK), GFP_KERNEL);
+    if (snap.bounce == NULL)
+    {
+        mutex_unlock(&file->read_lock);
+        return -ENOMEM;
+    }
+    
+    // fill as much of the destination as the buffer holds
+    while ((size_t)retval < count)
+    {
+        chunk = min_t(size_t, count - retval, AESD_READ_CHUNK);
+        tries = 0;
+        do
+        {
+            // writers keep winning, hold them off for one pass
+            if (++tries > AESD_READ_RETRIES)
+            {
+                aesd_dev_lock(dev);
+                locked = true;
+            }
+
+            cursor = file->cursor;
+            pos = *f_pos;
+            bytes = 0;
+            rcu_read_lock();
+            snap.seq = read_seqcount_begin(&dev->seq);
+            // at the end unless the cursor lands in an entry
+            next_seq = dev->records;
+            if (file->follow)
+            {
+                pos = aesd_cursor_follow(&dev->buffer, &cursor, pos);
+            }
+            if (aesd_cursor_seek(&dev->buffer, &cursor, pos))
+            {
+                bytes = aesd_circular_buffer_copy_from(&dev->buffer, &cursor.index, &cursor.offset,
+                                                       chunk, aesd_copy_to_bounce, &snap);
+                next_seq = aesd_entry_seq(dev, cursor.index);
+            }
+            rcu_read_unlock();
+        }while (!locked && read_seqcount_retry(&dev->seq, snap.seq));
+
+        if (locked)
+        {
+            mutex_unlock(&dev->lock);
+            locked = false;
+        }
+
+        if (bytes == 0)
+        {
+            read_seq = next_seq;
+            advanced = true;
+            break;
+        }
+
+        done = copy(io, retval, snap.bounce, bytes);
+        cursor.fpos += done;
+        *f_pos = pos + done;
+        retval += done;
+        if (done < bytes)
+        {
+            // the cursor is past what reached userspace, look up next time
+            cursor.fpos = -1;
+        }
+        file->cursor = cursor;
+        if (done < bytes)
+        {
+            break;
+        }
+        read_seq = next_seq;
+        advanced = true;
+    }
+
+    // what this file read no longer holds back writers
+    if (advanced)
+    {
+        aesd_file_advance(file, read_seq);
+    }
+    
+    kvfree(snap.bounce);
+    // release lock
+    mutex_unlock(&file->read_lock);
+
+    ns = ktime_get_ns() - start;
+    aesd_stat_inc(dev, reads);
+    aesd_stat_add(dev, read_bytes, retval);
+    aesd_stat_inc(dev, read_latency[aesd_latency_bucket(ns)]);
+    trace_aesd_read(MINOR(dev->cdev.dev), start_pos, count, retval, file->cursor.index, ns);
+    
+    if ((retval == 0) && io->fault)
+    {
+        retval = -EFAULT;
+    }
+    return retval;
+}
+
+/**
+ * Read like aesd_read_available(). A file following the device waits at
+ * the end of the data for the next entry instead of returning 0, or
+ * fails with -EAGAIN if nonblock is set.
+ */
+static ssize_t aesd_do_read(struct aesd_file *file, loff_t *f_pos, size_t count, bool nonblock,
+                aesd_circular_buffer_copy_fn copy, struct aesd_io *io)
+{
+    ssize_t retval = 0;
+    size_t end_offs = 0;
+
+    while (true)
+    {
+        // sampled first, so an entry committed during the read ends the wait
+        end_offs = READ_ONCE(file->dev->buffer.end_offs);
+        retval = aesd_read_available(file, f_pos, count, copy, io);
+        if ((retval != 0) || (count == 0) || !READ_ONCE(file->follow))
+        {
+            return retval;
+        }
+
+        if (nonblock)
+        {
+            return -EAGAIN;
+        }
+        if (wait_event_interruptible(file->dev->wait,
+                                     (READ_ONCE(file->dev->buffer.end_offs) != end_offs) ||
+                                     !READ_ONCE(file->follow)) != 0)
+        {
+            return -ERESTARTSYS;
+        }
+    }
+}
+
 ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
                 loff_t *f_pos)
 {
-    ssize_t retval = 0;
-    ssize_t entry_offset = 0;
-    struct aesd_buffer_entry *entry = NULL;
-    ssize_t bytes_to_copy = 0;
-    struct aesd_dev *dev = NULL;
+    struct aesd_io io = { .to = buf };
     PDEBUG("read %zu bytes with offset %lld",count,*f_pos);
     /**
      * handle read
@@ -78,50 +1273,197 @@ ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
         return -EINVAL;
     }
 
-    dev = filp->private_data;
-	
+    return aesd_do_read(filp->private_data, f_pos, count, (filp->f_flags & O_NONBLOCK) != 0,
+                        aesd_copy_to_user, &io);
+}
+
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct aesd_io io = { .iter = to };
+    PDEBUG("read_iter %zu bytes with offset %lld",iov_iter_count(to),iocb->ki_pos);
+
+    // the iovecs are filled from lockless snapshots of the buffer, the
+    // lock is taken only if writers keep changing it
+    return aesd_do_read(iocb->ki_filp->private_data, &iocb->ki_pos, iov_iter_count(to),
+                        ((iocb->ki_flags & IOCB_NOWAIT) != 0) || ((iocb->ki_filp->f_flags & O_NONBLOCK) != 0),
+                        aesd_copy_to_iter, &io);
+}
+
+/**
+ * Stage count bytes, copied in with copy, and commit an entry for every
+ * newline among them. Copies happen under the file's write lock only, the
+ * device lock is taken once to add all the finished lines together.
+ * Lines the device policy does not let in end the write before the newline
+ * of the first of them, nonblock fails instead of waiting for room.
+ */
+static ssize_t aesd_do_write(struct aesd_file *file, size_t count, bool nonblock,
+                aesd_copy_in_fn copy, struct aesd_io *io)
+{
+    ssize_t retval = 0;
+    struct aesd_dev *dev = file->dev;
+    struct aesd_stage *stage = &file->stage;
+    struct aesd_stage_chunk *chunk = NULL;
+    struct aesd_line line_buf[AESD_WRITE_LINES];
+    struct aesd_line *line = line_buf;
+    struct aesd_line *grown = NULL;
+    unsigned int line_max = AESD_WRITE_LINES;
+    unsigned int lines = 0;
+    int committed = 0;
+    size_t copied = 0;
+    size_t bytes = 0;
+    size_t done = 0;
+    size_t scan = 0;
+    size_t partial = 0;
+    size_t unwritten = 0;
+    char *newline = NULL;
+    unsigned int entries = 0;
+    u64 start = ktime_get_ns();
+    u64 ns = 0;
+    
     // acquire lock
-    if (mutex_lock_interruptible(&dev->lock) != 0)
+    if (mutex_lock_interruptible(&file->write_lock) != 0)
     {
         PDEBUG("mutex_lock_interruptible() acquiring lock error");
         return -ERESTARTSYS;
     }
+
+    // pick up a line a closed file left unfinished
+    if ((stage->size == 0) && (READ_ONCE(dev->stage.size) != 0))
+    {
+        aesd_dev_lock(dev);
+        aesd_stage_splice(&dev->stage, stage);
+        mutex_unlock(&dev->lock);
+    }
+    // bytes of the line being written, the stage holds no finished line yet
+    partial = stage->size;
     
-    entry = aesd_circular_buffer_find_entry_offset_for_fpos(&aesd_device.buffer,*f_pos, &entry_offset);
-    
-    if(entry != NULL)
+    while (copied < count)
     {
-    	bytes_to_copy = (entry->size - entry_offset);
-	if (bytes_to_copy > count)
-	{
-	    bytes_to_copy = count;
-	}
-	
-	retval = copy_to_user(buf, (entry->buffptr + entry_offset), bytes_to_copy);
-	if (retval != 0)
-	{
-	    PDEBUG("copy_to_user() error retval=%zu", retval);
-	}
-	else
-	{
-	    PDEBUG("copy_to_user() success retval=%zu", retval);
-	}
-	retval = (bytes_to_copy - retval);
-	*f_pos += retval;
+        // a line that can not fit under the byte limit is dropped, once
+        // the write that runs into the limit has reported what it took
+        if ((dev->max_bytes != 0) && (partial >= dev->max_bytes))
+        {
+            if (copied == 0)
+            {
+                PDEBUG("line longer than max_bytes %zu", dev->max_bytes);
+                aesd_stat_add(dev, staged_bytes, -(s64)stage->size);
+                aesd_stage_free(stage);
+                retval = -EFBIG;
+            }
+            break;
+        }
+
+        chunk = aesd_stage_tail(stage);
+        if (chunk == NULL)
+        {
+            PDEBUG("kmalloc() error");
+            retval = -ENOMEM;
+            break;
+        }
+
+        bytes = min(AESD_STAGE_CHUNK_DATA - chunk->used, count - copied);
+        if (dev->max_bytes != 0)
+        {
+            bytes = min(bytes, dev->max_bytes - partial);
+        }
+        done = copy(io, copied, chunk->data + chunk->used, bytes);
+        scan = chunk->used;
+        chunk->used += done;
+        stage->size += done;
+        copied += done;
+        aesd_stat_add(dev, staged_bytes, done);
+
+        // only the new bytes can hold a newline, each one ends a line
+        while ((newline = memchr(chunk->data + scan, '\n', chunk->used - scan)) != NULL)
+        {
+            if (lines == line_max)
+            {
+                grown = kvcalloc(line_max * 2, sizeof(*grown), GFP_KERNEL);
+                if (grown == NULL)
+                {
+                    // give back the newline and what this write copied after it
+                    PDEBUG("kvcalloc() error");
+                    unwritten = chunk->used - (newline - chunk->data);
+                    aesd_stage_truncate(dev, stage, stage->size - unwritten);
+                    copied -= unwritten;
+                    retval = -ENOMEM;
+                    break;
+                }
+                memcpy(grown, line, lines * sizeof(*line));
+                if (line != line_buf)
+                {
+                    kvfree(line);
+                }
+                line = grown;
+                line_max *= 2;
+            }
+            line[lines].len = partial + (newline + 1 - (chunk->data + scan));
+            lines++;
+            partial = 0;
+            scan = newline + 1 - chunk->data;
+        }
+        if (retval != 0)
+        {
+            break;
+        }
+        partial += chunk->used - scan;
+
+        if (done < bytes)
+        {
+            break;
+        }
+    }
+
+    if (lines != 0)
+    {
+        committed = aesd_commit_lines(dev, stage, line, lines, nonblock);
+        entries = max(committed, 0);
+        if (entries < lines)
+        {
+            // give back the newline of the first line not committed and what
+            // this write copied after it, so the next write does not join
+            // another line to it. The line before the newline stays staged
+            unwritten = stage->size - (line[entries].len - 1);
+            aesd_stage_truncate(dev, stage, line[entries].len - 1);
+            copied -= unwritten;
+            if (committed < 0)
+            {
+                retval = committed;
+            }
+        }
+    }
+    if (line != line_buf)
+    {
+        kvfree(line);
     }
     
+    ns = ktime_get_ns() - start;
+    trace_aesd_write(MINOR(dev->cdev.dev), count, (copied != 0) ? (ssize_t)copied : retval,
+                     entries, stage->size, ns);
+
     // release lock
-    mutex_unlock(&dev->lock);
-    
+    mutex_unlock(&file->write_lock);
+
+    aesd_stat_inc(dev, writes);
+    aesd_stat_add(dev, write_bytes, copied);
+    aesd_stat_inc(dev, write_latency[aesd_latency_bucket(ns)]);
+
+    // report what was taken, an error only if nothing was
+    if (copied != 0)
+    {
+        return copied;
+    }
+    if ((retval == 0) && io->fault)
+    {
+        retval = -EFAULT;
+    }
     return retval;
 }
 
 ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
                 loff_t *f_pos)
 {
-    ssize_t retval = 0;
-    struct aesd_dev *dev = NULL;
-    const char *free_buffptr = NULL;
+    struct aesd_io io = { .from = buf };
     
     PDEBUG("write %zu bytes with offset %lld",count,*f_pos);
     /**
@@ -130,92 +1472,49 @@ ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
      
     // check arguments
     if ((filp == NULL) || (buf == NULL))
-    {
-        PDEBUG("aesd_read() invalid arguments");
-        return -EINVAL;
-    }
-    
-    dev = filp->private_data;
-    
-    // acquire lock
-    if (mutex_lock_interruptible(&dev->lock) != 0)
-    {
-        PDEBUG("mutex_lock_interruptible() acquiring lock error");
-        return -ERESTARTSYS;
-    }
-    
-    // run commands once
-    do
-    {
-        // kernel malloc and error check
-	dev->entry.buffptr = krealloc(dev->entry.buffptr, (dev->entry.size + count),
-                                  GFP_KERNEL);//kmalloc(count, GFP_KERNEL);
-	if(dev->entry.buffptr == NULL)
-	{
-		PDEBUG("krealloc() error");
-		retval = -ENOMEM;
-		break;
-	}
-    
-    	retval = copy_from_user((void *)(dev->entry.buffptr + dev->entry.size), buf, count);
-    	if (retval != 0)
-	{
-	    PDEBUG("copy_from_user() error retval=%zu", retval);
-	    //break;
-	}
-    	retval = (count - retval);
-    	dev->entry.size += retval;
-    
-    	if (dev->entry.buffptr[dev->entry.size-1] == '\n')
-    	{
-    		free_buffptr = aesd_circular_buffer_add_entry(&dev->buffer, &dev->entry);
-	        // free previously allocated entry if any
-	        if (free_buffptr != NULL)
-	        {
-	            kfree(free_buffptr);
-	            free_buffptr = NULL;
-	        }
-	        
-	        dev->entry.buffptr = NULL;
-	        dev->entry.size = 0;
-	}
-    }while(0);
-    
-    // release lock
-    mutex_unlock(&dev->lock);
+    {
+        PDEBUG("aesd_write() invalid arguments");
+        return -EINVAL;
+    }
     
-    return retval;
+    return aesd_do_write(filp->private_data, count, (filp->f_flags & O_NONBLOCK) != 0,
+                         aesd_copy_from_user, &io);
+}
+
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct aesd_io io = { .iter = from };
+    struct aesd_file *file = iocb->ki_filp->private_data;
+
+    PDEBUG("write_iter %zu bytes with offset %lld",iov_iter_count(from),iocb->ki_pos);
+
+    // the lines of a writev are staged first and committed under one lock
+    return aesd_do_write(file, iov_iter_count(from),
+                         ((iocb->ki_flags & IOCB_NOWAIT) != 0) || ((iocb->ki_filp->f_flags & O_NONBLOCK) != 0),
+                         aesd_copy_from_iter, &io);
 }
 
 loff_t aesd_llseek(struct file *filp, loff_t off, int whence)
 {
-    int entry_index = 0;
     loff_t file_offset = 0;
     loff_t total_size = 0;
+    unsigned int seq = 0;
     struct aesd_dev *dev = NULL;
-    struct aesd_buffer_entry *entry = NULL;
     
     PDEBUG("aesd_llseek()");
 
-    dev = filp->private_data;
+    dev = ((struct aesd_file *)filp->private_data)->dev;
+    aesd_stat_inc(dev, seeks);
 	
-    // acquire lock
-    if (0 != mutex_lock_interruptible(&dev->lock))
-    {
-        PDEBUG("ERROR: mutex_lock_interruptible acquiring lock");
-        return -ERESTARTSYS;
-    }
-
-    // to get the total size
-    AESD_CIRCULAR_BUFFER_FOREACH(entry,&aesd_device.buffer,entry_index)
+    // to get the total size, retrying if a write lands meanwhile
+    do
     {
-        total_size += entry->size;
-    }
-	
-    // release lock
-    mutex_unlock(&dev->lock);
+        seq = read_seqcount_begin(&dev->seq);
+        total_size = aesd_circular_buffer_size(&dev->buffer);
+    }while (read_seqcount_retry(&dev->seq, seq));
 
     file_offset = fixed_size_llseek(filp, off, whence, total_size);
+    trace_aesd_llseek(MINOR(dev->cdev.dev), off, whence, total_size, file_offset);
     
     return file_offset;
 }
@@ -223,15 +1522,18 @@ loff_t aesd_llseek(struct file *filp, loff_t off, int whence)
 static long aesd_adjust_file_offset(struct file *filp, unsigned int write_cmd, unsigned int write_cmd_offset)
 {
 	long retval = 0;
-	int i;
-	int entry_length;
-	struct aesd_dev *dev = filp->private_data;
+	unsigned int seq = 0;
+	struct aesd_file *file = filp->private_data;
+	struct aesd_dev *dev = file->dev;
 	struct aesd_buffer_entry *entry = NULL;
+	struct aesd_cursor cursor;
+	u64 read_seq = 0;
 	
 	PDEBUG("aesd_adjust_file_offset()");
+	aesd_stat_inc(dev, seeks);
 
 	// acquire lock
-    	if (mutex_lock_interruptible(&dev->lock) != 0)
+    	if (mutex_lock_interruptible(&file->read_lock) != 0)
 	{
 		PDEBUG("mutex_lock_interruptible() acquiring lock error");
 		return -ERESTARTSYS;
@@ -240,52 +1542,354 @@ static long aesd_adjust_file_offset(struct file *filp, unsigned int write_cmd, u
 	do
 	{
 		PDEBUG("aesd_adjust_file_offset() start");
-		// check if write_cmd exceeds max writes supported
-		if (write_cmd > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
-		{		
-			PDEBUG("invalid");
-			retval = -EINVAL;
-			break; // release lock and exit
-	    	}
-	    	
-	    	// check if write_cmd exceeds no. of entries present
-	    	AESD_CIRCULAR_BUFFER_FOREACH(entry,&aesd_device.buffer,entry_length);
-		if (write_cmd > entry_length)
+		seq = read_seqcount_begin(&dev->seq);
+		retval = 0;
+
+		// check if write_cmd exceeds no. of entries present
+		entry = aesd_circular_buffer_entry_at(&dev->buffer, write_cmd);
+		if (entry == NULL)
 		{
 			PDEBUG("invalid");
 			retval = -EINVAL;
-			break; // release lock and exit
+			continue; // recheck and exit
 	    	}
 	    	
 		// check if offset exceeds size of entry
-		if (write_cmd_offset >= dev->buffer.entry[write_cmd].size)
+		if (write_cmd_offset >= entry->size)
 		{
 			PDEBUG("invalid");
 			retval = -EINVAL;
-			break; // release lock and exit
+			continue; // recheck and exit
 	    	}
 	    	
-	    	// adjust the file offset position
-	    	for (i=0; i<write_cmd; i++)
-		{
-			filp->f_pos += dev->buffer.entry[i].size;
-		}
-		filp->f_pos += write_cmd_offset;
+	    	// file offset of the entry, counted from the oldest one,
+		// where the next read starts with no lookup needed
+		cursor.index = dev->buffer.out_offs + write_cmd;
+		cursor.offset = write_cmd_offset;
+		cursor.fpos = aesd_circular_buffer_entry_fpos(&dev->buffer, entry) + write_cmd_offset;
+		cursor.generation = dev->buffer.generation;
+		read_seq = aesd_entry_seq(dev, cursor.index);
 		
+	}while (read_seqcount_retry(&dev->seq, seq));
+
+	if (retval == 0)
+	{
+		filp->f_pos = cursor.fpos;
+		file->cursor = cursor;
+		// a follower holds back writers from the entry it moved to
+		aesd_file_advance(file, read_seq);
 		PDEBUG("aesd_adjust_file_offset() completed");
-		
-	}while(0);
+	}
 
 	// release lock
-	mutex_unlock(&dev->lock);
+	mutex_unlock(&file->read_lock);
+
+	trace_aesd_adjust_file_offset(MINOR(dev->cdev.dev), write_cmd, write_cmd_offset, filp->f_pos, retval);
 	
 	return retval;
 }
 
+static long aesd_seek_after(struct file *filp, struct aesd_seekafter *seek)
+{
+	unsigned int seq = 0;
+	struct aesd_file *file = filp->private_data;
+	struct aesd_dev *dev = file->dev;
+	struct aesd_buffer_entry *entry = NULL;
+	struct aesd_cursor cursor;
+	uint32_t count = 0;
+	uint32_t n = 0;
+	u64 oldest = 0;
+	u64 read_seq = 0;
+	u64 timestamp = 0;
+
+	PDEBUG("aesd_seek_after()");
+	aesd_stat_inc(dev, seeks);
+
+	if (((seek->by != AESD_SEEK_BY_INDEX) && (seek->by != AESD_SEEK_BY_TIME)) || (seek->reserved != 0))
+	{
+		return -EINVAL;
+	}
+
+	// acquire lock
+	if (mutex_lock_interruptible(&file->read_lock) != 0)
+	{
+		PDEBUG("mutex_lock_interruptible() acquiring lock error");
+		return -ERESTARTSYS;
+	}
+
+	do
+	{
+		seq = read_seqcount_begin(&dev->seq);
+		count = aesd_circular_buffer_count(&dev->buffer);
+		oldest = dev->records - count;
+
+		// entries are in index and in time order, so both are a search from the oldest one
+		if (seek->by == AESD_SEEK_BY_TIME)
+		{
+			n = aesd_circular_buffer_find_entry_for_time(&dev->buffer, seek->value);
+		}
+		else
+		{
+			n = (seek->value <= oldest) ? 0 : (uint32_t)min_t(u64, seek->value - oldest, count);
+		}
+
+		// no entry past the last one, the file moves to the end of the data
+		entry = aesd_circular_buffer_entry_at(&dev->buffer, n);
+		cursor.index = dev->buffer.out_offs + n;
+		cursor.offset = 0;
+		cursor.fpos = (entry != NULL) ? aesd_circular_buffer_entry_fpos(&dev->buffer, entry) :
+			      aesd_circular_buffer_size(&dev->buffer);
+		cursor.generation = dev->buffer.generation;
+		read_seq = oldest + n;
+		timestamp = (entry != NULL) ? entry->timestamp : 0;
+
+	}while (read_seqcount_retry(&dev->seq, seq));
+
+	filp->f_pos = cursor.fpos;
+	file->cursor = cursor;
+	// a follower holds back writers from the entry it moved to
+	aesd_file_advance(file, read_seq);
+
+	// release lock
+	mutex_unlock(&file->read_lock);
+
+	seek->index = read_seq;
+	seek->timestamp = timestamp;
+	trace_aesd_seek_after(MINOR(dev->cdev.dev), seek->by, seek->value, read_seq, filp->f_pos, 0);
+
+	return 0;
+}
+
+__poll_t aesd_poll(struct file *filp, struct poll_table_struct *wait)
+{
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    __poll_t mask = 0;
+
+    poll_wait(filp, &dev->wait, wait);
+    poll_wait(filp, &dev->room, wait);
+
+    // writes wait only if the policy keeps followers from losing entries,
+    // a line of one byte stands for the next write
+    if (READ_ONCE(dev->policy) == AESD_POLICY_OVERWRITE)
+    {
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    }
+    else
+    {
+        aesd_dev_lock(dev);
+        if (aesd_check_room_locked(dev, 1, 1) == 0)
+        {
+            mask |= EPOLLOUT | EPOLLWRNORM;
+        }
+        mutex_unlock(&dev->lock);
+    }
+
+    // without follow a read at the end returns 0 at once, like a regular file
+    if (!READ_ONCE(file->follow) || aesd_file_readable(file, filp->f_pos))
+    {
+        mask |= EPOLLIN | EPOLLRDNORM;
+    }
+    return mask;
+}
+
+/**
+ * Allocate the header page and data ring of the mmap view,
+ * size is rounded up to a power of two of at least a page
+ */
+static int aesd_mmap_init(struct aesd_dev *dev, size_t size)
+{
+    size = roundup_pow_of_two(max_t(size_t, size, PAGE_SIZE));
+    dev->mmap_header = vmalloc_user(PAGE_SIZE + size);
+    if (dev->mmap_header == NULL)
+    {
+        return -ENOMEM;
+    }
+
+    dev->mmap_ring = (char *)dev->mmap_header + PAGE_SIZE;
+    dev->mmap_header->magic = AESD_MMAP_MAGIC;
+    dev->mmap_header->version = AESD_MMAP_VERSION;
+    dev->mmap_header->ring_size = size;
+    return 0;
+}
+
+/**
+ * Map the header page followed by the data ring twice, read only,
+ * see aesd_mmap.h for the layout
+ */
+int aesd_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    unsigned long ring_pages = 0;
+    unsigned long i = 0;
+    char *addr = NULL;
+    int ret = 0;
+
+    PDEBUG("mmap %lu pages", vma_pages(vma));
+
+    if (dev->mmap_header == NULL)
+    {
+        return -ENODEV;
+    }
+
+    // data is only written through write()
+    if (vma->vm_flags & VM_WRITE)
+    {
+        return -EACCES;
+    }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+    ring_pages = dev->mmap_header->ring_size >> PAGE_SHIFT;
+    if ((vma->vm_pgoff != 0) || (vma_pages(vma) > (1 + (2 * ring_pages))))
+    {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < vma_pages(vma); i++)
+    {
+        addr = (i == 0) ? (char *)dev->mmap_header :
+                          dev->mmap_ring + (((i - 1) % ring_pages) << PAGE_SHIFT);
+        ret = vm_insert_page(vma, vma->vm_start + (i << PAGE_SHIFT), vmalloc_to_page(addr));
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Commit every record of the batch at arg as one entry, under a single
+ * acquisition of the device lock. Entry buffers are allocated and filled
+ * before the lock is taken, so either all records are committed or none.
+ * Unless the policy is to overwrite, it waits for room for all of them, or
+ * fails with -EAGAIN if nonblock, and with -EFBIG if they can never fit.
+ * @return the number of records committed
+ */
+static long aesd_write_batch(struct aesd_file *file, const void __user *arg, bool nonblock)
+{
+    long retval = 0;
+    struct aesd_dev *dev = file->dev;
+    struct aesd_write_batch batch;
+    struct aesd_record *records = NULL;
+    char **buffptrs = NULL;
+    const char __user *payload = NULL;
+    size_t bytes = 0;
+    size_t written = 0;
+    uint32_t i = 0;
+    u64 start = ktime_get_ns();
+    u64 ns = 0;
+
+    if (copy_from_user(&batch, arg, sizeof(batch)) != 0)
+    {
+        return -EFAULT;
+    }
+    if ((batch.count == 0) || (batch.count > AESD_WRITE_BATCH_MAX))
+    {
+        return -EINVAL;
+    }
+
+    records = kvcalloc(batch.count, sizeof(*records), GFP_KERNEL);
+    buffptrs = kvcalloc(batch.count, sizeof(*buffptrs), GFP_KERNEL);
+    if ((records == NULL) || (buffptrs == NULL))
+    {
+        retval = -ENOMEM;
+        goto out;
+    }
+    if (copy_from_user(records, u64_to_user_ptr(batch.records), batch.count * sizeof(*records)) != 0)
+    {
+        retval = -EFAULT;
+        goto out;
+    }
+
+    payload = u64_to_user_ptr(batch.payload);
+    for (i = 0; i < batch.count; i++)
+    {
+        if ((records[i].len == 0) ||
+            ((u64)records[i].offset + records[i].len > batch.payload_len))
+        {
+            retval = -EINVAL;
+            goto out;
+        }
+        if ((dev->max_bytes != 0) && (records[i].len > dev->max_bytes))
+        {
+            retval = -EFBIG;
+            goto out;
+        }
+
+        buffptrs[i] = aesd_entry_alloc(dev, records[i].len);
+        if (buffptrs[i] == NULL)
+        {
+            retval = -ENOMEM;
+            goto out;
+        }
+        if (copy_from_user(buffptrs[i], payload + records[i].offset, records[i].len) != 0)
+        {
+            retval = -EFAULT;
+            goto out;
+        }
+        bytes += records[i].len;
+    }
+
+    aesd_dev_lock(dev);
+    // room for all of them at once, the policy may not drop any to fit
+    retval = aesd_wait_room_locked(dev, batch.count, bytes, nonblock);
+    if (retval != 0)
+    {
+        mutex_unlock(&dev->lock);
+        goto out;
+    }
+    write_seqcount_begin(&dev->seq);
+    for (i = 0; i < batch.count; i++)
+    {
+        records[i].index = aesd_add_entry_locked(dev, buffptrs[i], records[i].len);
+        // the buffer owns it now
+        buffptrs[i] = NULL;
+    }
+    write_seqcount_end(&dev->seq);
+    mutex_unlock(&dev->lock);
+
+    wake_up_interruptible(&dev->wait);
+    written = bytes;
+
+    // the records are committed even if their indices can not be returned
+    retval = batch.count;
+    if (copy_to_user(u64_to_user_ptr(batch.records), records, batch.count * sizeof(*records)) != 0)
+    {
+        retval = -EFAULT;
+    }
+
+out:
+    // counted like a write(2) of the whole payload
+    ns = ktime_get_ns() - start;
+    aesd_stat_inc(dev, writes);
+    aesd_stat_add(dev, write_bytes, written);
+    aesd_stat_inc(dev, write_latency[aesd_latency_bucket(ns)]);
+
+    if (buffptrs != NULL)
+    {
+        for (i = 0; i < batch.count; i++)
+        {
+            aesd_entry_free(buffptrs[i]);
+        }
+    }
+    kvfree(buffptrs);
+    kvfree(records);
+    return retval;
+}
+
 long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
 	long retval = 0;
  	struct aesd_seekto aesd_seekto_data;
+ 	struct aesd_seekafter aesd_seekafter_data;
+ 	uint32_t follow = 0;
+ 	uint32_t policy = 0;
  	
 	PDEBUG("aesd_ioctl()");
 
@@ -313,6 +1917,62 @@ long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
         		}
         	break;
 
+		case AESDCHAR_IOCSEEKAFTER:
+			retval = copy_from_user(&aesd_seekafter_data, (const void __user *)arg, sizeof(aesd_seekafter_data));
+        		if (retval != 0)
+        		{
+            			retval = -EFAULT;
+        		}
+        		else
+        		{
+				retval = aesd_seek_after(filp, &aesd_seekafter_data);
+				if ((retval == 0) &&
+				    (copy_to_user((void __user *)arg, &aesd_seekafter_data, sizeof(aesd_seekafter_data)) != 0))
+				{
+					retval = -EFAULT;
+				}
+        		}
+        	break;
+
+		case AESDCHAR_IOCFOLLOW:
+			retval = copy_from_user(&follow, (const void __user *)arg, sizeof(follow));
+        		if (retval != 0)
+        		{
+            			retval = -EFAULT;
+        		}
+        		else
+        		{
+				aesd_file_set_follow(filp->private_data, filp->f_pos, follow != 0);
+        		}
+        	break;
+
+		case AESDCHAR_IOCWRITEBATCH:
+			retval = aesd_write_batch(filp->private_data, (const void __user *)arg,
+						  (filp->f_flags & O_NONBLOCK) != 0);
+        	break;
+
+		case AESDCHAR_IOCSETPOLICY:
+			retval = copy_from_user(&policy, (const void __user *)arg, sizeof(policy));
+        		if (retval != 0)
+        		{
+            			retval = -EFAULT;
+        		}
+        		else if (policy > AESD_POLICY_EAGAIN)
+        		{
+        			retval = -EINVAL;
+        		}
+        		else
+        		{
+				struct aesd_dev *dev = ((struct aesd_file *)filp->private_data)->dev;
+
+				aesd_dev_lock(dev);
+				WRITE_ONCE(dev->policy, policy);
+				// waiting writers may go ahead or fail now
+				aesd_room_changed_locked(dev);
+				mutex_unlock(&dev->lock);
+        		}
+        	break;
+
  	    	default:
  			retval = -ENOTTY;
  			break;
@@ -327,82 +1987,260 @@ struct file_operations aesd_fops = {
     .owner =    THIS_MODULE,
     .read =     aesd_read,
     .write =    aesd_write,
+    .read_iter =    aesd_read_iter,
+    .write_iter =   aesd_write_iter,
+    // sendfile() and splice() go through read_iter, no copy to userspace
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read =  copy_splice_read,
+#else
+    .splice_read =  generic_file_splice_read,
+#endif
     .open =     aesd_open,
     .release =  aesd_release,
     .llseek =   aesd_llseek,
+    .poll =     aesd_poll,
+    .mmap =     aesd_mmap,
     .unlocked_ioctl = aesd_ioctl,
 };
 
-static int aesd_setup_cdev(struct aesd_dev *dev)
+static int aesd_setup_cdev(struct aesd_dev *dev, unsigned int index)
 {
-    int err, devno = MKDEV(aesd_major, aesd_minor);
+    int err, devno = MKDEV(aesd_major, aesd_minor + index);
 
     cdev_init(&dev->cdev, &aesd_fops);
     dev->cdev.owner = THIS_MODULE;
     dev->cdev.ops = &aesd_fops;
     err = cdev_add (&dev->cdev, devno, 1);
     if (err) {
-        printk(KERN_ERR "Error %d adding aesd cdev", err);
+        printk(KERN_ERR "Error %d adding aesd cdev %u", err, index);
     }
     return err;
 }
 
+/**
+ * Initialize the AESD specific portion of device index.
+ * On failure the device still has to be freed with aesd_dev_free().
+ */
+static int aesd_dev_init(struct aesd_dev *dev, unsigned int index)
+{
+    int result = 0;
+    uint capacity = 0;
+    char name[16];
+    struct dentry *dir = NULL;
+
+    mutex_init(&dev->lock);
+    seqcount_mutex_init(&dev->seq, &dev->lock);
+    init_waitqueue_head(&dev->wait);
+    init_waitqueue_head(&dev->room);
+    INIT_LIST_HEAD(&dev->followers);
+    aesd_stage_init(&dev->stage);
+    // the default buffer until max_entries is applied, so aesd_dev_free()
+    // finds a valid one whichever step below fails
+    aesd_circular_buffer_init(&dev->buffer);
+
+    if (max_entries_count != 0)
+    {
+        capacity = max_entries[min_t(int, index, max_entries_count - 1)];
+    }
+    if (max_bytes_count != 0)
+    {
+        dev->max_bytes = max_bytes[min_t(int, index, max_bytes_count - 1)];
+    }
+    if (full_policy_count != 0)
+    {
+        dev->policy = full_policy[min_t(int, index, full_policy_count - 1)];
+    }
+    if (capacity != 0)
+    {
+        result = aesd_circular_buffer_init_capacity(&dev->buffer, capacity);
+        if (result) {
+            printk(KERN_WARNING "Invalid max_entries %u\n", capacity);
+            return result;
+        }
+    }
+
+    // once the buffer is set up, aesd_dev_free() takes a NULL stats too
+    dev->stats = alloc_percpu(struct aesd_stats);
+    if (dev->stats == NULL)
+    {
+        return -ENOMEM;
+    }
+
+    if (mmap_size != 0)
+    {
+        result = aesd_mmap_init(dev, mmap_size);
+    }
+
+    // debugfs is optional, errors only leave the files out
+    snprintf(name, sizeof(name), "aesdchar%u", index);
+    dir = debugfs_create_dir(name, aesd_debugfs);
+    debugfs_create_file("alloc", S_IRUGO, dir, &dev->alloc_stats, &aesd_alloc_fops);
+    debugfs_create_file("stats", S_IRUGO, dir, dev, &aesd_stats_fops);
+    debugfs_create_file("latency", S_IRUGO, dir, dev, &aesd_latency_fops);
+    return result;
+}
+
+static void aesd_dev_free(struct aesd_dev *dev)
+{
+    uint32_t i = 0;
+    struct aesd_buffer_entry *entry = NULL;
+
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, &dev->buffer, i)
+    {
+	if(entry->buffptr != NULL)
+	{
+		aesd_entry_free(entry->buffptr);
+		entry->buffptr = NULL;
+	}
+    }
+    aesd_circular_buffer_free(&dev->buffer);
+    aesd_stage_free(&dev->stage);
+    for (i = 0; i < AESD_ENTRY_CLASSES; i++)
+    {
+        if (dev->spare[i] != NULL)
+        {
+            aesd_entry_buf_free(dev->spare[i]);
+            dev->spare[i] = NULL;
+        }
+    }
+    // mappings hold the module, none are left here
+    vfree(dev->mmap_header);
+    free_percpu(dev->stats);
+
+    // Destroy the mutex
+    mutex_destroy(&dev->lock);
+}
+
+/**
+ * Remove the first count devices, whose cdevs were added, and free them all
+ */
+static void aesd_remove_devices(unsigned int count)
+{
+    unsigned int i = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        cdev_del(&aesd_devices[i].cdev);
+    }
+    debugfs_remove_recursive(aesd_debugfs);
+    aesd_debugfs = NULL;
+
+    // wait for deferred frees of overwritten entries, then free buffers
+    rcu_barrier();
+    for (i = 0; i < count; i++)
+    {
+        aesd_dev_free(&aesd_devices[i]);
+    }
+    kfree(aesd_devices);
+    aesd_devices = NULL;
+}
+
+/**
+ * Create the entry caches, or none of them
+ */
+static int aesd_entry_caches_create(void)
+{
+    unsigned int c = 0;
+
+    for (c = 0; c < AESD_ENTRY_CLASSES; c++)
+    {
+        aesd_entry_caches[c] = kmem_cache_create(aesd_entry_cache_names[c], AESD_ENTRY_CLASS_SIZE(c), 0,
+                                                 SLAB_TYPESAFE_BY_RCU | SLAB_HWCACHE_ALIGN, NULL);
+        if (aesd_entry_caches[c] == NULL)
+        {
+            while (c-- > 0)
+            {
+                kmem_cache_destroy(aesd_entry_caches[c]);
+            }
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+static void aesd_entry_caches_destroy(void)
+{
+    unsigned int c = 0;
 
+    for (c = 0; c < AESD_ENTRY_CLASSES; c++)
+    {
+        kmem_cache_destroy(aesd_entry_caches[c]);
+        aesd_entry_caches[c] = NULL;
+    }
+}
 
 int aesd_init_module(void)
 {
     dev_t dev = 0;
     int result;
-    result = alloc_chrdev_region(&dev, aesd_minor, 1,
+    unsigned int i = 0;
+
+    if ((devices == 0) || (devices > AESD_MAX_DEVICES)) {
+        printk(KERN_WARNING "Invalid devices %u\n", devices);
+        return -EINVAL;
+    }
+    for (i = 0; i < full_policy_count; i++)
+    {
+        if (full_policy[i] > AESD_POLICY_EAGAIN) {
+            printk(KERN_WARNING "Invalid full_policy %u\n", full_policy[i]);
+            return -EINVAL;
+        }
+    }
+
+    result = alloc_chrdev_region(&dev, aesd_minor, devices,
             "aesdchar");
     aesd_major = MAJOR(dev);
     if (result < 0) {
         printk(KERN_WARNING "Can't get major %d\n", aesd_major);
         return result;
     }
-    memset(&aesd_device,0,sizeof(struct aesd_dev));
 
-    /**
-     * initialize the AESD specific portion of the device
-     */
-    mutex_init(&aesd_device.lock);
-    aesd_circular_buffer_init(&aesd_device.buffer);
+    result = aesd_entry_caches_create();
+    if (result) {
+        unregister_chrdev_region(dev, devices);
+        return result;
+    }
 
-    result = aesd_setup_cdev(&aesd_device);
+    // struct aesd_dev is padded to whole cache lines and kmalloc returns
+    // blocks this large cache line aligned, so no two devices share a line
+    aesd_devices = kcalloc(devices, sizeof(struct aesd_dev), GFP_KERNEL);
+    if (aesd_devices == NULL) {
+        aesd_entry_caches_destroy();
+        unregister_chrdev_region(dev, devices);
+        return -ENOMEM;
+    }
+    aesd_debugfs = debugfs_create_dir("aesdchar", NULL);
 
-    if( result ) {
-        unregister_chrdev_region(dev, 1);
+    for (i = 0; i < devices; i++)
+    {
+        result = aesd_dev_init(&aesd_devices[i], i);
+        if (result == 0)
+        {
+            result = aesd_setup_cdev(&aesd_devices[i], i);
+        }
+        if (result) {
+            aesd_dev_free(&aesd_devices[i]);
+            aesd_remove_devices(i);
+            aesd_entry_caches_destroy();
+            unregister_chrdev_region(dev, devices);
+            return result;
+        }
     }
-    return result;
+    return 0;
 
 }
 
 void aesd_cleanup_module(void)
 {
     dev_t devno = MKDEV(aesd_major, aesd_minor);
-    uint8_t i = 0;
-    struct aesd_buffer_entry *entry = NULL;
-
-    cdev_del(&aesd_device.cdev);
 
     /**
      * cleanup AESD specific poritions here as necessary
      */
-    
-    // free buffer
-    AESD_CIRCULAR_BUFFER_FOREACH(entry, &aesd_device.buffer, i)
-    {
-	if(entry->buffptr != NULL)
-	{
-		kfree(entry->buffptr);
-		entry->buffptr = NULL;
-	}
-    }
-
-    // Destroy the mutex
-    mutex_destroy(&aesd_device.lock);
+    aesd_remove_devices(devices);
+    aesd_entry_caches_destroy();
 
-    unregister_chrdev_region(devno, 1);
+    unregister_chrdev_region(devno, devices);
 }
 
 
@@ -0,0 +1,339 @@
+/***********************************************************************
+ * @file      		aesdloadgen.c
+ * @version   		0.1
+ * @brief		    Request latency load generator for aesdsocket over
+ *                  loopback TCP, the unix socket and the shm ring
+ *
+ * @author    		Amey More, Amey.More@Colorado.edu
+ * @date      		Oct 19, 2026
+ *
+ * @institution 	University of Colorado Boulder (UCB)
+ * @course      	ECEN 5713: Advanced Embedded Software Development
+ * @instructor  	Dan Walkes
+ *
+ * Usage: aesdloadgen [-t tcp|unix|shm|all] [-n requests] [-s packet_size]
+ *                    [-p port] [-f data_file]
+ *
+ * Transports are interleaved request by request so every transport
+ * reads back a data file of the same size.
+ ************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "aesdsocket.h"
+
+#define READ_BUF_LEN    (64 * 1024)
+
+enum transport
+{
+    TRANSPORT_TCP,
+    TRANSPORT_UNIX,
+    TRANSPORT_SHM,
+    TRANSPORT_COUNT
+};
+
+static const char *transport_names[TRANSPORT_COUNT] = { "tcp", "unix", "shm" };
+
+static const char *port = PORT;
+static const char *data_file = NULL;
+static char read_buf[READ_BUF_LEN];
+static shm_ring_t *ring = NULL;
+static int data_fd = -1;
+static char unix_socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static char shm_ring_name[64];
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+static int connect_stream(enum transport transport)
+{
+    int fd;
+    int ret;
+    struct addrinfo hints;
+    struct addrinfo *result;
+    struct sockaddr_un addr;
+
+    if(transport == TRANSPORT_UNIX)
+    {
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, unix_socket_path, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd == RET_ERROR)
+        {
+            return RET_ERROR;
+        }
+        ret = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    }
+    else
+    {
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if(getaddrinfo("127.0.0.1", port, &hints, &result) != 0)
+        {
+            return RET_ERROR;
+        }
+        fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+        if(fd == RET_ERROR)
+        {
+            freeaddrinfo(result);
+            return RET_ERROR;
+        }
+        ret = connect(fd, result->ai_addr, result->ai_addrlen);
+        freeaddrinfo(result);
+    }
+
+    if(ret == RET_ERROR)
+    {
+        close(fd);
+        return RET_ERROR;
+    }
+    return fd;
+}
+
+// send one packet on a stream transport and read the whole reply
+static int stream_request(enum transport transport, const char *packet, size_t len)
+{
+    int fd;
+    ssize_t ret;
+
+    fd = connect_stream(transport);
+    if(fd == RET_ERROR)
+    {
+        return RET_ERROR;
+    }
+
+    if(send(fd, packet, len, 0) != (ssize_t)len)
+    {
+        close(fd);
+        return RET_ERROR;
+    }
+
+    do
+    {
+        ret = recv(fd, read_buf, READ_BUF_LEN, 0);
+    }while(ret > 0);
+
+    close(fd);
+    return (ret == 0) ? RET_SUCCESS : RET_ERROR;
+}
+
+// commit one packet through the ring and read back the committed range
+static int shm_request(const char *packet, size_t len)
+{
+    int64_t offset;
+    int64_t end;
+    ssize_t ret;
+    size_t chunk;
+
+    if(shm_ring_request(ring, packet, len, &offset, &end) == RET_ERROR)
+    {
+        return RET_ERROR;
+    }
+
+    while(offset < end)
+    {
+        chunk = ((end - offset) < READ_BUF_LEN) ? (end - offset) : READ_BUF_LEN;
+        ret = pread(data_fd, read_buf, chunk, offset);
+        if(ret <= 0)
+        {
+            return RET_ERROR;
+        }
+        offset += ret;
+    }
+    return RET_SUCCESS;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void report(const char *name, uint64_t *latency, size_t count)
+{
+    size_t i;
+    uint64_t sum = 0;
+
+    if(count == 0)
+    {
+        return;
+    }
+
+    qsort(latency, count, sizeof(uint64_t), compare_u64);
+    for(i = 0; i < count; i++)
+    {
+        sum += latency[i];
+    }
+
+    printf("%-6s %8zu %10.1f %10.1f %10.1f %10.1f\n", name, count,
+            (sum / (double)count) / 1000.0,
+            latency[count / 2] / 1000.0,
+            latency[(count * 99) / 100] / 1000.0,
+            latency[count - 1] / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    int t;
+    size_t i;
+    size_t requests = 1000;
+    size_t packet_size = 32;
+    bool enabled[TRANSPORT_COUNT] = { true, true, true };
+    uint64_t *latency[TRANSPORT_COUNT];
+    size_t done[TRANSPORT_COUNT] = { 0 };
+    char *packet;
+    size_t len;
+    uint64_t start;
+    int ret;
+
+    while((opt = getopt(argc, argv, "t:n:s:p:f:")) != -1)
+    {
+        switch(opt)
+        {
+            case 't':
+                if(strcmp(optarg, "all") != 0)
+                {
+                    for(t = 0; t < TRANSPORT_COUNT; t++)
+                    {
+                        enabled[t] = (strcmp(optarg, transport_names[t]) == 0);
+                    }
+                }
+                break;
+            case 'n':
+                requests = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                packet_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                port = optarg;
+                break;
+            case 'f':
+                data_file = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t tcp|unix|shm|all] [-n requests] "
+                                "[-s packet_size] [-p port] [-f data_file]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    // same naming as aesdsocket for instances on other ports
+    if(strcmp(port, PORT) != 0)
+    {
+        snprintf(unix_socket_path, sizeof(unix_socket_path), "%s-%s", UNIX_SOCKET_PATH, port);
+        snprintf(shm_ring_name, sizeof(shm_ring_name), "%s-%s", SHM_RING_NAME, port);
+    }
+    else
+    {
+        snprintf(unix_socket_path, sizeof(unix_socket_path), "%s", UNIX_SOCKET_PATH);
+        snprintf(shm_ring_name, sizeof(shm_ring_name), "%s", SHM_RING_NAME);
+    }
+
+    if((packet_size < 2) || (packet_size > SHM_RING_SLOT_DATA))
+    {
+        fprintf(stderr, "packet size must be between 2 and %d\n", SHM_RING_SLOT_DATA);
+        return 1;
+    }
+
+    if(enabled[TRANSPORT_SHM])
+    {
+        if(data_file == NULL)
+        {
+            data_file = (access("/dev/aesdchar", R_OK) == 0) ?
+                            "/dev/aesdchar" : "/var/tmp/aesdsocketdata";
+        }
+        ring = shm_ring_attach(shm_ring_name);
+        data_fd = open(data_file, O_RDONLY);
+        if((ring == NULL) || (data_fd == RET_ERROR))
+        {
+            fprintf(stderr, "shm transport unavailable: %s\n", strerror(errno));
+            enabled[TRANSPORT_SHM] = false;
+        }
+    }
+
+    packet = malloc(packet_size);
+    for(t = 0; t < TRANSPORT_COUNT; t++)
+    {
+        latency[t] = malloc(requests * sizeof(uint64_t));
+        if((packet == NULL) || (latency[t] == NULL))
+        {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+    }
+
+    for(i = 0; i < requests; i++)
+    {
+        for(t = 0; t < TRANSPORT_COUNT; t++)
+        {
+            if(!enabled[t])
+            {
+                continue;
+            }
+
+            // "<transport> <n> xxxx...\n", packet_size bytes
+            len = snprintf(packet, packet_size, "%s %zu ", transport_names[t], i);
+            if(len >= packet_size)
+            {
+                len = packet_size - 1;
+            }
+            memset(packet + len, 'x', packet_size - len - 1);
+            packet[packet_size - 1] = '\n';
+
+            start = now_ns();
+            if(t == TRANSPORT_SHM)
+            {
+                ret = shm_request(packet, packet_size);
+            }
+            else
+            {
+                ret = stream_request(t, packet, packet_size);
+            }
+            if(ret == RET_ERROR)
+            {
+                fprintf(stderr, "%s request failed: %s\n", transport_names[t], strerror(errno));
+                enabled[t] = false;
+                continue;
+            }
+            latency[t][done[t]++] = now_ns() - start;
+        }
+    }
+
+    printf("%-6s %8s %10s %10s %10s %10s\n", "", "requests", "mean(us)", "p50(us)", "p99(us)", "max(us)");
+    for(t = 0; t < TRANSPORT_COUNT; t++)
+    {
+        report(transport_names[t], latency[t], done[t]);
+        free(latency[t]);
+    }
+
+    free(packet);
+    if(ring != NULL)
+    {
+        shm_ring_detach(ring);
+    }
+    if(data_fd != RET_ERROR)
+    {
+        close(data_fd);
+    }
+    return 0;
+}
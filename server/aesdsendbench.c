@@ -0,0 +1,258 @@
+/***********************************************************************
+ * @file      		aesdsendbench.c
+ * @version   		0.1
+ * @brief		    Compares sending the data file to a TCP client with
+ *                  read()+send() against sendfile()
+ *
+ * @author    		Amey More, Amey.More@Colorado.edu
+ * @date      		Oct 19, 2026
+ *
+ * @institution 	University of Colorado Boulder (UCB)
+ * @course      	ECEN 5713: Advanced Embedded Software Development
+ * @instructor  	Dan Walkes
+ *
+ * Usage: aesdsendbench [-f data_file] [-s total_bytes] [-b chunk_size]
+ *
+ * The data file is sent over a loopback TCP connection from its start,
+ * again and again, until total_bytes went out in each mode. A thread
+ * drains the other end. CPU time is that of the sending thread only,
+ * which is where the two modes differ.
+ ************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/resource.h>
+
+#define RET_SUCCESS 		(0)
+#define RET_ERROR 		    (-1)
+
+#define RECV_BUF_LEN    (256 * 1024)
+
+enum mode
+{
+    MODE_READ_SEND,
+    MODE_SENDFILE,
+    MODE_COUNT
+};
+
+static const char *mode_names[MODE_COUNT] = { "read+send", "sendfile" };
+
+static uint64_t received = 0;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+// user plus system time of the calling thread
+static uint64_t thread_cpu_ns()
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_THREAD, &usage);
+    return ((uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ull) +
+           ((uint64_t)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ull);
+}
+
+static void *drain_thread(void *arg)
+{
+    int fd = *(int *)arg;
+    char *buf = malloc(RECV_BUF_LEN);
+    ssize_t ret;
+
+    while((buf != NULL) && ((ret = recv(fd, buf, RECV_BUF_LEN, 0)) > 0))
+    {
+        __atomic_fetch_add(&received, ret, __ATOMIC_RELEASE);
+    }
+    free(buf);
+    return NULL;
+}
+
+// a connected loopback TCP pair, the client end is returned in send_fd
+static int connect_pair(int *send_fd, int *recv_fd)
+{
+    int listen_fd;
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if((listen_fd == RET_ERROR) ||
+       (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == RET_ERROR) ||
+       (getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len) == RET_ERROR) ||
+       (listen(listen_fd, 1) == RET_ERROR))
+    {
+        return RET_ERROR;
+    }
+
+    *send_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if((*send_fd == RET_ERROR) ||
+       (connect(*send_fd, (struct sockaddr *)&addr, sizeof(addr)) == RET_ERROR))
+    {
+        close(listen_fd);
+        return RET_ERROR;
+    }
+    *recv_fd = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+    return (*recv_fd == RET_ERROR) ? RET_ERROR : RET_SUCCESS;
+}
+
+// send the whole data file once, the way aesdsocket did before sendfile
+static ssize_t send_pass_read(int data_fd, int sock_fd, char *buf, size_t chunk)
+{
+    ssize_t total = 0;
+    ssize_t ret;
+    ssize_t sent;
+    ssize_t n;
+
+    if(lseek(data_fd, 0, SEEK_SET) == RET_ERROR)
+    {
+        return RET_ERROR;
+    }
+    while((ret = read(data_fd, buf, chunk)) > 0)
+    {
+        for(sent = 0; sent < ret; sent += n)
+        {
+            n = send(sock_fd, buf + sent, ret - sent, 0);
+            if(n == RET_ERROR)
+            {
+                return RET_ERROR;
+            }
+        }
+        total += ret;
+    }
+    return (ret == RET_ERROR) ? RET_ERROR : total;
+}
+
+static ssize_t send_pass_sendfile(int data_fd, int sock_fd, size_t chunk)
+{
+    ssize_t total = 0;
+    ssize_t ret;
+
+    if(lseek(data_fd, 0, SEEK_SET) == RET_ERROR)
+    {
+        return RET_ERROR;
+    }
+    while((ret = sendfile(sock_fd, data_fd, NULL, chunk)) > 0)
+    {
+        total += ret;
+    }
+    return (ret == RET_ERROR) ? RET_ERROR : total;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    int m;
+    const char *data_file = NULL;
+    uint64_t target = 256ull << 20;
+    size_t chunk = 64 * 1024;
+    int data_fd;
+    int send_fd;
+    int recv_fd;
+    pthread_t drain;
+    char *buf;
+    uint64_t sent;
+    uint64_t start;
+    uint64_t cpu_start;
+    double seconds;
+    double cpu_seconds;
+    ssize_t ret;
+
+    while((opt = getopt(argc, argv, "f:s:b:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'f':
+                data_file = optarg;
+                break;
+            case 's':
+                target = strtoull(optarg, NULL, 0);
+                break;
+            case 'b':
+                chunk = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-f data_file] [-s total_bytes] [-b chunk_size]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if(data_file == NULL)
+    {
+        data_file = (access("/dev/aesdchar", R_OK) == 0) ? "/dev/aesdchar" : "/var/tmp/aesdsocketdata";
+    }
+    data_fd = open(data_file, O_RDONLY);
+    buf = malloc(chunk);
+    if((data_fd == RET_ERROR) || (buf == NULL) || (chunk == 0))
+    {
+        fprintf(stderr, "%s: %s\n", data_file, strerror(errno));
+        return 1;
+    }
+
+    if(connect_pair(&send_fd, &recv_fd) == RET_ERROR)
+    {
+        fprintf(stderr, "loopback connection failed: %s\n", strerror(errno));
+        return 1;
+    }
+    pthread_create(&drain, NULL, drain_thread, &recv_fd);
+
+    printf("%s, %zu byte chunks\n", data_file, chunk);
+    printf("%-10s %10s %10s %10s %12s\n", "", "MB", "seconds", "MB/s", "CPU s/GB");
+    for(m = 0; m < MODE_COUNT; m++)
+    {
+        sent = 0;
+        start = now_ns();
+        cpu_start = thread_cpu_ns();
+        while(sent < target)
+        {
+            ret = (m == MODE_SENDFILE) ? send_pass_sendfile(data_fd, send_fd, chunk) :
+                                         send_pass_read(data_fd, send_fd, buf, chunk);
+            if(ret <= 0)
+            {
+                fprintf(stderr, "%s failed: %s\n", mode_names[m],
+                        (ret == 0) ? "data file is empty" : strerror(errno));
+                return 1;
+            }
+            sent += ret;
+        }
+        cpu_seconds = (thread_cpu_ns() - cpu_start) / 1e9;
+
+        // done once the other end has it all
+        while(__atomic_load_n(&received, __ATOMIC_ACQUIRE) < sent)
+        {
+            sched_yield();
+        }
+        __atomic_fetch_sub(&received, sent, __ATOMIC_RELEASE);
+        seconds = (now_ns() - start) / 1e9;
+
+        printf("%-10s %10.1f %10.3f %10.1f %12.3f\n", mode_names[m], sent / 1e6, seconds,
+               (sent / 1e6) / seconds, cpu_seconds / (sent / 1e9));
+    }
+
+    close(send_fd);
+    pthread_join(drain, NULL);
+    close(recv_fd);
+    close(data_fd);
+    free(buf);
+    return 0;
+}
@@ -3,7 +3,7 @@
 echo "Checking arguments for aesdsocket script..."
 if [ $# -ne 1 ]; then
     echo "Error : Arguments not specified correctly!!!"
-    echo "Usage: $ ./aesdsocket-start-stop.sh <start/stop>"
+    echo "Usage: $ ./aesdsocket-start-stop.sh <start/stop/restart>"
     exit 1
 else
     echo "Pass"
@@ -20,8 +20,14 @@ case "$1" in
 		echo "Stop AESD socket application"
 		start-stop-daemon -K -n aesdsocket
 		;;
+	restart)
+		# the new instance takes over port 9000 from the running one,
+		# which drains its connections and exits on its own
+		echo "Restart AESD socket application"
+		/usr/bin/aesdsocket -d -u
+		;;
 	*)
-		echo "Usage: $ ./aesdsocket-start-stop.sh <start/stop>"
+		echo "Usage: $ ./aesdsocket-start-stop.sh <start/stop/restart>"
 		exit 1
 esac
 
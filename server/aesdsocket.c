@@ -25,7 +25,9 @@
  ************************************************************************/
 #include "aesdsocket.h"
 
+#ifndef USE_AESD_CHAR_DEVICE
 #define USE_AESD_CHAR_DEVICE (1) // used for build switching
+#endif
 
 #if (USE_AESD_CHAR_DEVICE == 1)
 	#define DATA_FILE "/dev/aesdchar"
@@ -36,13 +38,20 @@
 /*
 *   Global Data
 */
+// port 9000 by default, -p picks another so instances can share a host
+const char *port = PORT;
+const char *data_file = DATA_FILE;
+// local transport names, suffixed with the port when it is not 9000
+char handoff_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+char unix_socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+char shm_ring_name[64];
 // Process termination
 volatile sig_atomic_t terminate_process = 0;
 // Daemon application
 bool daemon_mode = false;
 // Outout data file
 //char *data_file = "/var/tmp/aesdsocketdata";
-int data_file_fd;
+int data_file_fd = -1;
 // Server & Client Socket fd
 int socket_fd;
 int accept_fd;
@@ -51,11 +60,47 @@ SLIST_HEAD(head_s, node) head;
 node_t * new_node = NULL;
 // thread mutex
 pthread_mutex_t mutex;
+// orders connection threads waiting for mutex, -q and -P tune it
+fair_sched_t fair_sched;
 // timestamp struct
 timestamp_data_t timestamp_data;
+bool timestamp_running = false;
 
-#if (USE_AESD_CHAR_DEVICE == 1)
 const char *ioctl_str = "AESDCHAR_IOCSEEKTO:";
+// returns the data and then streams every later write, like tail -f
+const char *follow_str = "AESDCHAR_IOCFOLLOW";
+// returns the data from the first entry at or after index,<n> or time,<ns since the epoch>
+const char *seekafter_str = "AESDCHAR_IOCSEEKAFTER:";
+// cleared if the driver cannot splice, readback then goes through send_buf
+bool use_sendfile = true;
+
+// restart without rebinding, taking over from a running instance
+bool upgrade_mode = false;
+// listener for a successor instance and our connection to it
+int handoff_fd = -1;
+int handoff_conn_fd = -1;
+// connection to the instance we are taking over from
+int upgrade_conn_fd = -1;
+// set once the listening socket belongs to a successor
+volatile sig_atomic_t handed_off = 0;
+// local transports
+int unix_socket_fd = -1;
+shm_ring_server_t *shm_ring = NULL;
+pthread_t shm_ring_thread_id;
+
+#if (USE_AESD_CHAR_DEVICE != 1)
+// record start offsets in DATA_FILE, protected by mutex
+record_index_t record_index;
+// false while the index is still arriving from the old instance
+bool record_index_ready = true;
+pthread_cond_t record_index_cond = PTHREAD_COND_INITIALIZER;
+pthread_t handoff_state_thread_id;
+bool handoff_state_started = false;
+// replication: -L <port> to serve followers, -F <host:port> to follow
+const char *repl_listen_port = NULL;
+const char *repl_leader = NULL;
+pthread_cond_t repl_cond = PTHREAD_COND_INITIALIZER;
+repl_context_t repl_context;
 #endif
 
 /*
@@ -68,7 +113,32 @@ int start_communication();
 void global_clean_up();
 void *recv_send_thread(void *thread_param);
 int setup_timestamp();
+int setup_record_index();
+void set_local_names();
+bool read_only();
 void *timestamp_thread(void *timestamp_param);
+int open_data_file();
+int append_data(int fd, const char *buf, size_t len);
+int parse_command(const char *buf, size_t len, command_t *command);
+int seek_to_record(int fd, struct aesd_seekto *seekto, pthread_mutex_t *mutex);
+#if (USE_AESD_CHAR_DEVICE == 1)
+int seek_after_record(int fd, const char *arg);
+int follow_data_file(thread_data_t *thread_data, fair_flow_t *flow, int fd, char *buf);
+int sendfile_data_file(thread_data_t *thread_data, fair_flow_t *flow, int fd);
+#endif
+void reap_connections(bool wait_all);
+int start_handoff();
+int finish_handoff();
+int receive_socket();
+int start_connection(int listen_fd);
+int open_unix_socket();
+int setup_shm_ring();
+void stop_shm_ring();
+void *shm_ring_thread(void *thread_param);
+void *handoff_state_thread(void *thread_param);
+int setup_replication();
+void wait_record_index();
+bool replication_stopping();
 
 
 void handle_termination(int signo)
@@ -78,19 +148,26 @@ void handle_termination(int signo)
 	{
 		syslog(LOG_INFO,"Caught signal, exiting\n");
 
-		ret = shutdown(socket_fd,SHUT_RDWR);
-		if(ret == RET_ERROR)
+		// the listening socket is shared with a successor after handoff
+		if(!handed_off)
 		{
-			syslog(LOG_ERR,"shutdown failed");
-		}
+			ret = shutdown(socket_fd,SHUT_RDWR);
+			if(ret == RET_ERROR)
+			{
+				syslog(LOG_ERR,"shutdown failed");
+			}
 
 #if (USE_AESD_CHAR_DEVICE != 1)
-        ret = pthread_cancel(timestamp_data.thread_id);
-        if(ret != 0)
-        {
-            syslog(LOG_ERR,"pthread cancel failed");
-        }
+			if(timestamp_running)
+			{
+				ret = pthread_cancel(timestamp_data.thread_id);
+				if(ret != 0)
+				{
+					syslog(LOG_ERR,"pthread cancel failed");
+				}
+			}
 #endif
+		}
 
 		terminate_process = 1;
 	}
@@ -122,16 +199,50 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+	fair_sched_init(&fair_sched, FAIR_SCHED_QUANTUM);
+
     // to parse arguments
-	while((opt = getopt(argc, argv, "d")) != -1)  
+	while((opt = getopt(argc, argv, "dup:f:q:P:L:F:")) != -1)  
 	{
 		switch(opt)  
         	{
         		case 'd':
 	        		daemon_mode = true;
 	        		break; 
+        		case 'u':
+	        		upgrade_mode = true;
+	        		break; 
+        		case 'p':
+	        		port = optarg;
+	        		break; 
+        		case 'f':
+	        		data_file = optarg;
+	        		break; 
+        		case 'q':
+	        		fair_sched.quantum = strtoul(optarg, NULL, 0);
+	        		if(fair_sched.quantum < BUF_LEN)
+	        		{
+	        			fair_sched.quantum = BUF_LEN;
+	        		}
+	        		break; 
+        		case 'P':
+	        		// <address>[/<prefix>]:<class 0-3>
+	        		if(fair_sched_add_rule(&fair_sched, optarg) == RET_ERROR)
+	        		{
+	        			syslog(LOG_ERR,"Invalid priority rule %s", optarg);
+	        		}
+	        		break; 
+#if (USE_AESD_CHAR_DEVICE != 1)
+        		case 'L':
+	        		repl_listen_port = optarg;
+	        		break; 
+        		case 'F':
+	        		repl_leader = optarg;
+	        		break; 
+#endif
         	}
 	}
+	set_local_names();
 
 	// signal handler for SIGINT and SIGTERM
 	signal(SIGINT, handle_termination);
@@ -167,10 +278,14 @@ int socket_application()
     *  failing and returning -1 if any of the 
     *  socket connection steps fail.
     *********************************************************/
-    ret = open_socket();
-    if(ret == RET_ERROR)
+    socket_fd = receive_socket();
+    if(socket_fd == RET_ERROR)
     {
-        return -1;
+        ret = open_socket();
+        if(ret == RET_ERROR)
+        {
+            return -1;
+        }
     }
 
     /********************************************************* 
@@ -187,11 +302,27 @@ int socket_application()
     }
 
 #if (USE_AESD_CHAR_DEVICE != 1)
-    ret = setup_timestamp();
+    ret = setup_record_index();
+    if(ret == RET_ERROR)
+    {
+        return -1;
+    }
+
+    ret = setup_replication();
     if(ret == RET_ERROR)
     {
         return -1;
     }
+
+    // timestamps on a follower arrive from the leader
+    if(repl_leader == NULL)
+    {
+        ret = setup_timestamp();
+        if(ret == RET_ERROR)
+        {
+            return -1;
+        }
+    }
 #endif
 
     /********************************************************* 
@@ -208,12 +339,40 @@ int socket_application()
         return -1;
     }
 
+    // a later instance started with -u takes over from here
+    handoff_fd = handoff_listen(handoff_path);
+    if(handoff_fd == RET_ERROR)
+    {
+        syslog(LOG_ERR,"Handoff listen failed, restart will rebind");
+    }
+
+    // local transports are optional, port 9000 keeps working without them
+    unix_socket_fd = open_unix_socket();
+    if(unix_socket_fd == RET_ERROR)
+    {
+        syslog(LOG_ERR,"Unix socket %s setup failed", unix_socket_path);
+    }
+    ret = setup_shm_ring();
+    if(ret == RET_ERROR)
+    {
+        syslog(LOG_ERR,"Shared memory ring setup failed");
+    }
+
     ret = start_communication();
     if(ret == RET_ERROR)
     {
         return -1;
     }
 
+    if(handed_off)
+    {
+        ret = finish_handoff();
+        if(ret == RET_ERROR)
+        {
+            return -1;
+        }
+    }
+
     return 0;
 }
 
@@ -236,7 +395,7 @@ int open_socket()
 	hints.ai_addr = NULL;
 	hints.ai_next = NULL;
 
-    ret = getaddrinfo(NULL, PORT, &hints, &result);
+    ret = getaddrinfo(NULL, port, &hints, &result);
     if (ret != RET_SUCCESS)
     {
         syslog(LOG_ERR,"getaddrinfo() failed");
@@ -354,144 +513,357 @@ int start_daemon()
 // accept, receive and send socket commands
 int start_communication()
 {
-    // int ret;
-    int pt_ret;
-
-    // for pthreads
-    void * thread_rtn = NULL;
-
-    // for accept() command
-	struct sockaddr_storage client_addr;
-	socklen_t client_addrlen = sizeof(struct sockaddr_storage);
+    int ret;
+    int i;
+    struct pollfd poll_fds[3];
 
     while(!terminate_process)
 	{
-        accept_fd = accept(socket_fd, (struct sockaddr *)&client_addr, &client_addrlen);
-        if(accept_fd == RET_ERROR)
+        // wait for a client on any transport or for a successor instance
+        poll_fds[0].fd = socket_fd;
+        poll_fds[1].fd = unix_socket_fd;
+        poll_fds[2].fd = handoff_fd;
+        for(i = 0; i < 3; i++)
         {
-            if(terminate_process == 0)
+            poll_fds[i].events = POLLIN;
+            poll_fds[i].revents = 0;
+        }
+
+        ret = poll(poll_fds, 3, -1);
+        if(ret == RET_ERROR)
+        {
+            if(errno == EINTR)
             {
-                syslog(LOG_ERR,"Accept failed");
-                return -1;
+                continue;
             }
-            else
+            syslog(LOG_ERR,"Poll failed");
+            return -1;
+        }
+
+        if(poll_fds[2].revents & POLLIN)
+        {
+            ret = start_handoff();
+            if(ret == RET_SUCCESS)
             {
                 return 0;
             }
         }
-        
-        /*
-        inet_ntop(client_addr.ss_family,
-                    get_in_addr((struct sockaddr *)&client_addr),
-                    s, sizeof s);
-        syslog(LOG_INFO,"Accepted connection from %s",s);
 
-        ret = recv_send_thread();
-        if(ret == RET_ERROR)
+        for(i = 0; i < 2; i++)
         {
-            return -1;
-        }
-        */
-
-        /********************************************************* 
-        *  STEP 6 : 
-        *  Logs message to the syslog “Closed connection from XXX”
-        *  where XXX is the IP address of the connected client.
-        *  
-        *  Restarts accepting connections from new clients forever 
-        *  in a loop until SIGINT or SIGTERM is received.
-        *********************************************************/
-        /*
-        close(accept_fd);
-        syslog(LOG_INFO,"Closed connection from %s",s);
-        */
+            if(!(poll_fds[i].revents & (POLLIN | POLLERR | POLLHUP)))
+            {
+                continue;
+            }
 
-        // add new node in linked list
-        new_node = malloc(sizeof(node_t));
-        if(new_node == NULL)
-        {
-            syslog(LOG_ERR,"Node malloc failed");
-            return -1;
+            ret = start_connection(poll_fds[i].fd);
+            if(ret == RET_ERROR)
+            {
+                return (terminate_process == 0) ? -1 : 0;
+            }
         }
-        new_node->thread_data.mutex = &mutex;
-        new_node->thread_data.thread_complete = false;
-        new_node->thread_data.accept_fd = accept_fd;
-        new_node->thread_data.client_addr = (struct sockaddr_storage *)&client_addr;
-
-        // create threads and start communication
-        pt_ret = pthread_create(&(new_node->thread_data.thread_id), NULL, \
-                                    recv_send_thread, &(new_node->thread_data));
-        if(pt_ret == RET_ERROR)
+
+        // check for thread completion
+        reap_connections(false);
+    }
+
+    return 0;
+}
+
+// accept one client on listen_fd and start its connection thread
+int start_connection(int listen_fd)
+{
+    int pt_ret;
+
+    // for accept() command
+	struct sockaddr_storage client_addr;
+	socklen_t client_addrlen = sizeof(struct sockaddr_storage);
+
+    accept_fd = accept(listen_fd, (struct sockaddr *)&client_addr, &client_addrlen);
+    if(accept_fd == RET_ERROR)
+    {
+        if(terminate_process == 0)
         {
-            syslog(LOG_ERR, "Thread create failed");
-            free(new_node);
-            return -1;
+            syslog(LOG_ERR,"Accept failed");
         }
-        
-        // Actually insert the node e into the queue
-        SLIST_INSERT_HEAD(&head, new_node, nodes);
+        return -1;
+    }
+
+    /********************************************************* 
+    *  STEP 6 : 
+    *  Logs message to the syslog “Closed connection from XXX”
+    *  where XXX is the IP address of the connected client.
+    *  
+    *  Restarts accepting connections from new clients forever 
+    *  in a loop until SIGINT or SIGTERM is received.
+    *********************************************************/
+
+    // add new node in linked list
+    new_node = malloc(sizeof(node_t));
+    if(new_node == NULL)
+    {
+        syslog(LOG_ERR,"Node malloc failed");
+        close(accept_fd);
+        return -1;
+    }
+    new_node->thread_data.mutex = &mutex;
+    new_node->thread_data.sched = &fair_sched;
+    new_node->thread_data.thread_complete = false;
+    new_node->thread_data.accept_fd = accept_fd;
+    memcpy(&new_node->thread_data.client_addr, &client_addr, client_addrlen);
+
+    // create threads and start communication
+    pt_ret = pthread_create(&(new_node->thread_data.thread_id), NULL, \
+                                recv_send_thread, &(new_node->thread_data));
+    if(pt_ret != 0)
+    {
+        syslog(LOG_ERR, "Thread create failed");
+        close(accept_fd);
+        free(new_node);
         new_node = NULL;
+        return -1;
+    }
+    
+    // Actually insert the node e into the queue
+    SLIST_INSERT_HEAD(&head, new_node, nodes);
+    new_node = NULL;
 
-        // check for thread completion
-        SLIST_FOREACH(new_node, &head, nodes)
+    return 0;
+}
+
+/*
+*   Join connection threads and free their nodes. Only completed
+*   threads are joined unless wait_all is set, which blocks until
+*   every in-flight connection has finished.
+*/
+void reap_connections(bool wait_all)
+{
+    int pt_ret;
+    node_t *node;
+    node_t *next;
+
+    node = SLIST_FIRST(&head);
+    while(node != NULL)
+    {
+        next = SLIST_NEXT(node, nodes);
+        if(wait_all || node->thread_data.thread_complete)
         {
-            if(new_node->thread_data.thread_complete)
+            pt_ret = pthread_join(node->thread_data.thread_id, NULL);
+            if(pt_ret != 0)
+            {
+                syslog(LOG_ERR, "Thread join failed");
+            }
+            else
             {
-                pt_ret = pthread_join(new_node->thread_data.thread_id,&thread_rtn);
-                if(pt_ret == RET_ERROR)
-                {
-                    syslog(LOG_ERR, "Thread join failed");
-                    return -1;
-                }
-                if(thread_rtn == NULL)
-                {
-                    return -1;
-                }
-                syslog(LOG_INFO, "Thread join %ld",new_node->thread_data.thread_id);
+                syslog(LOG_INFO, "Thread join %ld",node->thread_data.thread_id);
             }
-        } 
+            SLIST_REMOVE(&head, node, node, nodes);
+            free(node);
+        }
+        node = next;
+    }
+}
+
+/*
+*   A successor instance connected on the handoff socket: pass it the
+*   listening socket so the accept backlog is kept, and stop accepting.
+*   The caller drains in-flight connections and then sends the state.
+*/
+int start_handoff()
+{
+    int ret;
+
+    handoff_conn_fd = handoff_accept(handoff_fd);
+    if(handoff_conn_fd == RET_ERROR)
+    {
+        syslog(LOG_ERR,"Handoff accept failed: %s", strerror(errno));
+        return -1;
+    }
+
+#if (USE_AESD_CHAR_DEVICE != 1)
+    // followers reconnect to the successor
+    repl_leader_close();
+#endif
+
+    // let the successor bind its own handoff socket
+    close(handoff_fd);
+    handoff_fd = RET_ERROR;
+    unlink(handoff_path);
+
+    ret = handoff_send_fd(handoff_conn_fd, socket_fd);
+    if(ret == RET_ERROR)
+    {
+        syslog(LOG_ERR,"Handoff of listening socket failed");
+        close(handoff_conn_fd);
+        handoff_conn_fd = RET_ERROR;
+        handoff_fd = handoff_listen(handoff_path);
+        return -1;
     }
 
+    handed_off = 1;
+    close(socket_fd);
+    socket_fd = RET_ERROR;
+
+    // the successor binds its own local transports, leave the paths alone
+    if(unix_socket_fd != RET_ERROR)
+    {
+        close(unix_socket_fd);
+        unix_socket_fd = RET_ERROR;
+    }
+    if(shm_ring != NULL)
+    {
+        shm_ring_stop(shm_ring);
+    }
+    syslog(LOG_INFO,"Listening socket handed off, draining connections");
     return 0;
 }
 
+/*
+*   Runs in the old instance after start_handoff(): wait for every
+*   in-flight connection, then send the in-memory state.
+*/
+int finish_handoff()
+{
+    int ret = 0;
+
+    reap_connections(true);
+    stop_shm_ring();
+
+#if (USE_AESD_CHAR_DEVICE != 1)
+    repl_stop();
+
+    // no more appends once the timestamp thread is gone
+    if(timestamp_running)
+    {
+        pthread_cancel(timestamp_data.thread_id);
+        pthread_join(timestamp_data.thread_id, NULL);
+        timestamp_running = false;
+    }
+
+    pthread_mutex_lock(&mutex);
+    ret = handoff_send_index(handoff_conn_fd, &record_index);
+    pthread_mutex_unlock(&mutex);
+    if(ret == RET_ERROR)
+    {
+        syslog(LOG_ERR,"Handoff of record index failed");
+    }
+#endif
+
+    close(handoff_conn_fd);
+    handoff_conn_fd = RET_ERROR;
+    syslog(LOG_INFO,"Handoff complete");
+    return ret;
+}
+
+/*
+*   Obtain the listening socket without binding port 9000 again:
+*   from a running instance when started with -u, or from a
+*   supervisor via LISTEN_FDS. Returns -1 if neither is available.
+*/
+int receive_socket()
+{
+    int fd;
+
+    fd = inherited_listen_fd();
+    if(fd != RET_ERROR)
+    {
+        syslog(LOG_INFO,"Using inherited listening socket");
+        return fd;
+    }
+
+    if(!upgrade_mode)
+    {
+        return RET_ERROR;
+    }
+
+    upgrade_conn_fd = handoff_connect(handoff_path);
+    if(upgrade_conn_fd == RET_ERROR)
+    {
+        syslog(LOG_INFO,"No running instance to upgrade from");
+        return RET_ERROR;
+    }
+
+    fd = handoff_recv_fd(upgrade_conn_fd);
+    if(fd == RET_ERROR)
+    {
+        syslog(LOG_ERR,"Handoff receive failed");
+        close(upgrade_conn_fd);
+        upgrade_conn_fd = RET_ERROR;
+        return RET_ERROR;
+    }
+    syslog(LOG_INFO,"Received listening socket from running instance");
+
+#if (USE_AESD_CHAR_DEVICE == 1)
+    // the char driver holds all state, nothing more to receive
+    close(upgrade_conn_fd);
+    upgrade_conn_fd = RET_ERROR;
+#endif
+    return fd;
+}
+
 // thread function for receive and send commmands
 void *recv_send_thread(void *thread_param)
 {
 	int is_ioctl = 1;
+	bool follow = false;
 	int ret;
-    	// receive bytes
+	// receive bytes
 	ssize_t recv_bytes = 0;
 	char recv_buf[BUF_LEN];
+	command_t command;
 
-	// for data output file
-	int file_flags;
-	mode_t file_mode;
+	// data file, opened once for the whole connection
+	int data_fd;
 	
-	// send bytes
+	// send bytes, up to one scheduler turn at a time
 	ssize_t send_bytes = 0;
-	char send_buf[BUF_LEN];
-	ssize_t bytes_read;
+	char *send_buf;
+	size_t bytes_read;
+	ssize_t read_ret = 0;
+
+	// this connection's share of data file time
+	fair_flow_t flow;
+	size_t budget;
 
-    	// to print IP
-    	char s[INET6_ADDRSTRLEN];
+	// to print IP
+	char s[INET6_ADDRSTRLEN];
 
 	memset(recv_buf, 0, BUF_LEN);
-	memset(send_buf, 0, BUF_LEN);
 
 	thread_data_t *thread_data = (thread_data_t*)thread_param;
 
-	inet_ntop(thread_data->client_addr->ss_family,
-                get_in_addr((struct sockaddr *)&(thread_data->client_addr)),
-                s, sizeof s);
+	if(thread_data->client_addr.ss_family == AF_UNIX)
+	{
+		strcpy(s, "local");
+	}
+	else
+	{
+		inet_ntop(thread_data->client_addr.ss_family,
+                	get_in_addr((struct sockaddr *)&(thread_data->client_addr)),
+                	s, sizeof s);
+	}
 	syslog(LOG_INFO,"Accepted connection from %s",s);
 
-	syslog(LOG_INFO,"Started thread %ld",thread_data->thread_id);
+	// the tid names this thread in kernel traces, see aesd-char-driver/aesdtrace
+	syslog(LOG_INFO,"Started thread %ld tid %ld for %s",thread_data->thread_id,(long)syscall(SYS_gettid),s);
 
-	// open data file flags
-	file_flags = (O_RDWR | O_CREAT | O_APPEND);
-	file_mode = (S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP | S_IROTH);
-	
+	fair_flow_init(&flow, fair_sched_weight(thread_data->sched, &thread_data->client_addr));
+	send_buf = malloc(thread_data->sched->quantum * flow.weight);
+	if(send_buf == NULL)
+	{
+		syslog(LOG_ERR,"Send buffer malloc failed");
+		fair_flow_destroy(&flow);
+		return NULL;
+	}
+
+	data_fd = open_data_file();
+	if(data_fd == RET_ERROR)
+	{
+		syslog(LOG_ERR,"Data file open failed");
+		DEBUG_LOG("Application Failure\n");
+		DEBUG_LOG("Check logs\n");
+		goto out;
+	}
 
     /********************************************************* 
     *  STEP 4 : 
@@ -507,69 +879,76 @@ void *recv_send_thread(void *thread_param)
         if(recv_bytes == RET_ERROR)
         {
             syslog(LOG_ERR,"Receive failed");
-            return NULL;
+            goto out;
+        }
+        // client closed before completing the packet
+        if(recv_bytes == 0)
+        {
+            break;
         }
         
-        is_ioctl = strncmp(recv_buf, ioctl_str, strlen(ioctl_str));
+        ret = parse_command(recv_buf, recv_bytes, &command);
+        is_ioctl = 1;
         
-	if (is_ioctl == 0)
+	if (command.type == COMMAND_SEEKTO)
 	{
-		struct aesd_seekto aesd_seekto_data;
-		sscanf(recv_buf, "AESDCHAR_IOCSEEKTO:%d,%d", &aesd_seekto_data.write_cmd, &aesd_seekto_data.write_cmd_offset); 
-		
-		data_file_fd = open(DATA_FILE, file_flags, file_mode);
-		if(data_file_fd == RET_ERROR)
-		{
-			syslog(LOG_ERR,"Data file open failed");
-			DEBUG_LOG("Application Failure\n");
-			DEBUG_LOG("Check logs\n");
-			return NULL;
-		}
-	
-		//ioctl(data_file_fd, AESDCHAR_IOCSEEKTO, &aesd_seekto_data);
-	    	if(ioctl(data_file_fd, AESDCHAR_IOCSEEKTO, &aesd_seekto_data) != 0)
+		is_ioctl = 0;
+	    	if((ret == RET_ERROR) || (seek_to_record(data_fd, &command.seekto, thread_data->mutex) != 0))
 	    	{
 			syslog(LOG_ERR,"ioctl failed");
-			//return NULL;
 	    	}
 	}
-	else
+#if (USE_AESD_CHAR_DEVICE == 1)
+	else if(command.type == COMMAND_SEEKAFTER)
 	{
-		data_file_fd = open(DATA_FILE, file_flags, file_mode);
-		if(data_file_fd == RET_ERROR)
+		// reply from the entry found, not from the start
+		is_ioctl = 0;
+		if((ret == RET_ERROR) || (seek_after_record(data_fd, command.seekafter) != 0))
 		{
-			syslog(LOG_ERR,"Data file open failed");
-			DEBUG_LOG("Application Failure\n");
-			DEBUG_LOG("Check logs\n");
-			return NULL;
+			syslog(LOG_ERR,"ioctl failed");
 		}
-		
+	}
+	else if(command.type == COMMAND_FOLLOW)
+	{
+		// keep the connection after the reply, nothing is written
+		follow = true;
+	}
+#endif
+	else
+	{
+		// wait for our turn, a chunk is never larger than a quantum
+		fair_acquire(thread_data->sched, &flow);
+
 		// acquire lock
 		ret = pthread_mutex_lock(thread_data->mutex);
 		if(ret == RET_ERROR)
 		{
 			syslog(LOG_ERR,"mutex lock failed\n");
-			return NULL;
+			fair_release(thread_data->sched, &flow);
+			goto out;
 		}
 
-		// write data to file
-		ret = write(data_file_fd, recv_buf, recv_bytes);
-		if(ret == RET_ERROR)
+		// write data to file, a follower only takes data from its leader
+		ret = RET_SUCCESS;
+		if(!read_only())
 		{
-		    syslog(LOG_ERR,"File write failed");
-		    return NULL;
+			ret = append_data(data_fd, recv_buf, recv_bytes);
 		}
 		
 		// release lock
-	    	ret = pthread_mutex_unlock(thread_data->mutex);
-	    	if(ret == RET_ERROR)
+	    	if(pthread_mutex_unlock(thread_data->mutex) == RET_ERROR)
 	    	{
 			syslog(LOG_ERR,"mutex unlock failed\n");
-			return NULL;
+			fair_release(thread_data->sched, &flow);
+			goto out;
 	    	}
-	    	
-	    	// close data file
-		close(data_file_fd);
+		fair_release(thread_data->sched, &flow);
+
+		if(ret == RET_ERROR)
+		{
+		    syslog(LOG_ERR,"File write failed");
+		    goto out;
+		}
     	}
     }while((memchr(recv_buf, '\n', recv_bytes)) == NULL);
 
@@ -582,47 +961,65 @@ void *recv_send_thread(void *thread_param)
     *********************************************************/
     if(is_ioctl != 0)
     {
-    	/*off_t seek_ret = lseek(data_file_fd, 0, SEEK_SET);
+    	off_t seek_ret = lseek(data_fd, 0, SEEK_SET);
     	if(seek_ret == RET_ERROR)
     	{
         	syslog(LOG_ERR,"lseek failed");
-        	return NULL;
-    	}*/
-	data_file_fd = open(DATA_FILE, file_flags, file_mode);
-	if(data_file_fd == RET_ERROR)
-	{
-		syslog(LOG_ERR,"Data file open failed");
-		DEBUG_LOG("Application Failure\n");
-		DEBUG_LOG("Check logs\n");
-		return NULL;
-	}
+        	goto out;
+    	}
     }
 
-    // read and send
-    do
+    read_ret = 1;
+#if (USE_AESD_CHAR_DEVICE == 1)
+    // the driver reads without locks, the kernel moves its data to the socket
+    if(use_sendfile)
+    {
+        if(sendfile_data_file(thread_data, &flow, data_fd) == RET_ERROR)
+        {
+            goto out;
+        }
+        read_ret = use_sendfile ? 0 : 1;
+    }
+#endif
+
+    // read and send, one budget worth of data file per turn
+    while(read_ret > 0)
     {
+	budget = fair_acquire(thread_data->sched, &flow);
+
         // acquire lock
 	ret = pthread_mutex_lock(thread_data->mutex);
 	if(ret == RET_ERROR)
 	{
 		syslog(LOG_ERR,"mutex lock failed\n");
-		return NULL;
+		fair_release(thread_data->sched, &flow);
+		goto out;
 	}
     
-        // read data from file
-        bytes_read = read(data_file_fd, send_buf, BUF_LEN);
-        if(bytes_read == RET_ERROR)
+        // read data from file until the budget is full or the data ends,
+        // a read can return less than asked before the end
+        bytes_read = 0;
+        do
         {
-            syslog(LOG_ERR,"File read failed");
-            return NULL;
-        }
+            read_ret = read(data_fd, send_buf + bytes_read, budget - bytes_read);
+            if(read_ret > 0)
+            {
+                bytes_read += read_ret;
+            }
+        }while((read_ret > 0) && (bytes_read < budget));
         
     	// release lock
 	ret = pthread_mutex_unlock(thread_data->mutex);
+	fair_release(thread_data->sched, &flow);
+        if(read_ret == RET_ERROR)
+        {
+            syslog(LOG_ERR,"File read failed");
+            goto out;
+        }
 	if(ret == RET_ERROR)
 	{
 		syslog(LOG_ERR,"mutex unlock failed\n");
-		return NULL;
+		goto out;
 	}
         
         // send data on socket
@@ -630,16 +1027,524 @@ void *recv_send_thread(void *thread_param)
         if(send_bytes == RET_ERROR)
         {
             syslog(LOG_ERR,"Send failed");
-            return NULL;
+            goto out;
         }
-    }while(bytes_read > 0);
+    }
+
+#if (USE_AESD_CHAR_DEVICE == 1)
+    if(follow && (follow_data_file(thread_data, &flow, data_fd, send_buf) == RET_ERROR))
+    {
+        goto out;
+    }
+#else
+    (void)follow;
+#endif
 
-    //close(data_file_fd);
+    close(data_fd);
+    data_fd = -1;
     close(thread_data->accept_fd);
     syslog(LOG_INFO,"Closed connection from %s",s);
 
     // thread completed
     thread_data->thread_complete = true;
+
+out:
+    if(data_fd != -1)
+    {
+        close(data_fd);
+    }
+    free(send_buf);
+    fair_flow_destroy(&flow);
+    return thread_data->thread_complete ? thread_param : NULL;
+}
+
+// open DATA_FILE for appending packets and reading them back
+int open_data_file()
+{
+	int file_flags = (O_RDWR | O_CREAT | O_APPEND);
+	mode_t file_mode = (S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP | S_IROTH);
+
+	return open(data_file, file_flags, file_mode);
+}
+
+/*
+*   Append len bytes of buf to the data file.
+*   Caller must hold the data mutex so that the record index stays
+*   in step with the file contents.
+*/
+int append_data(int fd, const char *buf, size_t len)
+{
+	ssize_t ret;
+	size_t written = 0;
+
+#if (USE_AESD_CHAR_DEVICE != 1)
+	// appends must land after everything the old instance wrote
+	wait_record_index();
+#endif
+
+	while(written < len)
+	{
+		ret = write(fd, buf + written, len - written);
+		if(ret == RET_ERROR)
+		{
+			return RET_ERROR;
+		}
+		written += ret;
+	}
+
+#if (USE_AESD_CHAR_DEVICE != 1)
+	if(record_index_append(&record_index, buf, len) == RET_ERROR)
+	{
+		syslog(LOG_ERR,"record index append failed");
+		return RET_ERROR;
+	}
+	// wake replication threads, costs nothing without followers
+	if(repl_listen_port != NULL)
+	{
+		pthread_cond_broadcast(&repl_cond);
+	}
+#endif
+	return RET_SUCCESS;
+}
+
+/*
+*   Tell a command packet of len bytes, which need not be NUL terminated,
+*   from data, for connections and the shared memory ring alike. Sets
+*   command->type even when the command's argument is malformed or too
+*   long, in which case it returns RET_ERROR with errno set.
+*/
+int parse_command(const char *buf, size_t len, command_t *command)
+{
+	char cmd_buf[COMMAND_LEN];
+	const char *prefix;
+
+	memset(command, 0, sizeof(*command));
+	if((len > strlen(ioctl_str)) && (strncmp(buf, ioctl_str, strlen(ioctl_str)) == 0))
+	{
+		command->type = COMMAND_SEEKTO;
+		prefix = ioctl_str;
+	}
+#if (USE_AESD_CHAR_DEVICE == 1)
+	else if((len > strlen(seekafter_str)) && (strncmp(buf, seekafter_str, strlen(seekafter_str)) == 0))
+	{
+		command->type = COMMAND_SEEKAFTER;
+		prefix = seekafter_str;
+	}
+	else if((len >= strlen(follow_str)) && (strncmp(buf, follow_str, strlen(follow_str)) == 0))
+	{
+		command->type = COMMAND_FOLLOW;
+		return RET_SUCCESS;
+	}
+#endif
+	else
+	{
+		command->type = COMMAND_NONE;
+		return RET_SUCCESS;
+	}
+
+	// a command frame is never appended as data, however long
+	if(len >= sizeof(cmd_buf))
+	{
+		errno = EMSGSIZE;
+		return RET_ERROR;
+	}
+	memcpy(cmd_buf, buf, len);
+	cmd_buf[len] = '\0';
+
+	if(command->type == COMMAND_SEEKTO)
+	{
+		if(sscanf(cmd_buf + strlen(prefix), "%u,%u", &command->seekto.write_cmd,
+				&command->seekto.write_cmd_offset) != 2)
+		{
+			errno = EINVAL;
+			return RET_ERROR;
+		}
+	}
+	else
+	{
+		strcpy(command->seekafter, cmd_buf + strlen(prefix));
+	}
+	return RET_SUCCESS;
+}
+
+/*
+*   Position fd at the write_cmd_offset byte of the write_cmd record.
+*   The char driver handles this with AESDCHAR_IOCSEEKTO, the data
+*   file uses the in-memory record index.
+*/
+int seek_to_record(int fd, struct aesd_seekto *seekto, pthread_mutex_t *mutex)
+{
+#if (USE_AESD_CHAR_DEVICE == 1)
+	(void)mutex;
+	return ioctl(fd, AESDCHAR_IOCSEEKTO, seekto);
+#else
+	int ret;
+	off_t file_offset;
+
+	ret = pthread_mutex_lock(mutex);
+	if(ret == RET_ERROR)
+	{
+		syslog(LOG_ERR,"mutex lock failed\n");
+		return RET_ERROR;
+	}
+	wait_record_index();
+	ret = record_index_lookup(&record_index, seekto->write_cmd,
+				seekto->write_cmd_offset, &file_offset);
+	pthread_mutex_unlock(mutex);
+
+	if(ret == RET_ERROR)
+	{
+		errno = EINVAL;
+		return RET_ERROR;
+	}
+
+	if(lseek(fd, file_offset, SEEK_SET) == RET_ERROR)
+	{
+		return RET_ERROR;
+	}
+	return RET_SUCCESS;
+#endif
+}
+
+#if (USE_AESD_CHAR_DEVICE == 1)
+/*
+*   Position fd at the first entry at or after arg, "index,<n>" for
+*   an entry index or "time,<ns>" for a CLOCK_REALTIME time in ns,
+*   which the driver compares in CLOCK_MONOTONIC.
+*/
+int seek_after_record(int fd, const char *arg)
+{
+	struct aesd_seekafter seekafter;
+	struct timespec realtime;
+	struct timespec monotonic;
+	unsigned long long value;
+	int64_t offset;
+
+	memset(&seekafter, 0, sizeof(seekafter));
+	if(sscanf(arg, "index,%llu", &value) == 1)
+	{
+		seekafter.by = AESD_SEEK_BY_INDEX;
+		seekafter.value = value;
+	}
+	else if(sscanf(arg, "time,%llu", &value) == 1)
+	{
+		// the clocks are read back to back, close enough for entry timestamps
+		if((clock_gettime(CLOCK_REALTIME, &realtime) == RET_ERROR) ||
+		   (clock_gettime(CLOCK_MONOTONIC, &monotonic) == RET_ERROR))
+		{
+			return RET_ERROR;
+		}
+		offset = ((int64_t)realtime.tv_sec - monotonic.tv_sec) * 1000000000LL +
+			 (realtime.tv_nsec - monotonic.tv_nsec);
+		seekafter.by = AESD_SEEK_BY_TIME;
+		// a time before boot finds the oldest entry
+		seekafter.value = ((int64_t)value > offset) ? (uint64_t)((int64_t)value - offset) : 0;
+	}
+	else
+	{
+		errno = EINVAL;
+		return RET_ERROR;
+	}
+
+	if(ioctl(fd, AESDCHAR_IOCSEEKAFTER, &seekafter) == RET_ERROR)
+	{
+		return RET_ERROR;
+	}
+	return RET_SUCCESS;
+}
+
+/*
+*   Send the data file from its current offset to the client with
+*   sendfile(), one scheduler turn per call. Clears use_sendfile and
+*   sends nothing if the driver has no splice_read.
+*/
+int sendfile_data_file(thread_data_t *thread_data, fair_flow_t *flow, int fd)
+{
+	size_t budget;
+	ssize_t sent;
+	bool first = true;
+
+	do
+	{
+		budget = fair_acquire(thread_data->sched, flow);
+		sent = sendfile(thread_data->accept_fd, fd, NULL, budget);
+		fair_release(thread_data->sched, flow);
+
+		if((sent == RET_ERROR) && first && ((errno == EINVAL) || (errno == ENOSYS)))
+		{
+			syslog(LOG_INFO,"sendfile unsupported, using read and send");
+			use_sendfile = false;
+			return RET_SUCCESS;
+		}
+		first = false;
+	}while(sent > 0);
+
+	if(sent == RET_ERROR)
+	{
+		syslog(LOG_ERR,"sendfile failed");
+		return RET_ERROR;
+	}
+	return RET_SUCCESS;
+}
+
+/*
+*   Send writes to the client as the driver commits them, until the
+*   client closes or sends anything more, or the server stops. The
+*   driver wakes poll() for every new entry, the timeout only bounds
+*   how long a stop takes to be noticed.
+*/
+int follow_data_file(thread_data_t *thread_data, fair_flow_t *flow, int fd, char *buf)
+{
+	uint32_t on = 1;
+	struct pollfd poll_fds[2];
+	size_t budget;
+	ssize_t read_ret;
+	int ret;
+	int flags;
+
+	flags = fcntl(fd, F_GETFL);
+	if((ioctl(fd, AESDCHAR_IOCFOLLOW, &on) == RET_ERROR) || (flags == RET_ERROR) ||
+	   (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == RET_ERROR))
+	{
+		syslog(LOG_ERR,"Follow setup failed");
+		return RET_ERROR;
+	}
+
+	poll_fds[0].fd = fd;
+	poll_fds[0].events = POLLIN;
+	poll_fds[1].fd = thread_data->accept_fd;
+	poll_fds[1].events = POLLIN;
+
+	while(!terminate_process && !handed_off)
+	{
+		ret = poll(poll_fds, 2, FOLLOW_STOP_CHECK_MS);
+		if(ret == RET_ERROR)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			syslog(LOG_ERR,"Poll failed");
+			return RET_ERROR;
+		}
+
+		// the client closed or sent another packet, following ends
+		if(poll_fds[1].revents != 0)
+		{
+			break;
+		}
+		if(!(poll_fds[0].revents & POLLIN))
+		{
+			continue;
+		}
+
+		// one turn per wakeup, reads take no lock in the driver
+		budget = fair_acquire(thread_data->sched, flow);
+		read_ret = read(fd, buf, budget);
+		fair_release(thread_data->sched, flow);
+		if(read_ret == RET_ERROR)
+		{
+			if(errno == EAGAIN)
+			{
+				continue;
+			}
+			syslog(LOG_ERR,"File read failed");
+			return RET_ERROR;
+		}
+
+		if(send(thread_data->accept_fd, buf, read_ret, 0) == RET_ERROR)
+		{
+			syslog(LOG_ERR,"Send failed");
+			return RET_ERROR;
+		}
+	}
+
+	return RET_SUCCESS;
+}
+#endif
+
+// listen on the unix socket path for clients on this host
+int open_unix_socket()
+{
+    int fd;
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, unix_socket_path, sizeof(addr.sun_path) - 1);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == RET_ERROR)
+    {
+        return -1;
+    }
+
+    // replace a stale socket, or the one of an instance we took over from
+    unlink(unix_socket_path);
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == RET_ERROR)
+    {
+        close(fd);
+        return -1;
+    }
+    chmod(unix_socket_path, 0666);
+
+    if(listen(fd, BACKLOG_CONNECTIONS) == RET_ERROR)
+    {
+        close(fd);
+        unlink(unix_socket_path);
+        return -1;
+    }
+    return fd;
+}
+
+// create the shared memory ring and the thread serving it
+int setup_shm_ring()
+{
+    int pt_ret;
+
+    shm_ring = shm_ring_create(shm_ring_name, SHM_RING_SLOTS);
+    if(shm_ring == NULL)
+    {
+        return -1;
+    }
+
+    pt_ret = pthread_create(&shm_ring_thread_id, NULL, shm_ring_thread, shm_ring);
+    if(pt_ret != 0)
+    {
+        shm_ring_destroy(shm_ring, shm_ring_name);
+        shm_ring = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void stop_shm_ring()
+{
+    if(shm_ring == NULL)
+    {
+        return;
+    }
+
+    shm_ring_stop(shm_ring);
+    pthread_join(shm_ring_thread_id, NULL);
+    // after a handoff the name belongs to the successor's ring
+    shm_ring_destroy(shm_ring, handed_off ? NULL : shm_ring_name);
+    shm_ring = NULL;
+}
+
+/*
+*   Serve packets from the shared memory ring. Each one is handled
+*   like a packet on port 9000, but rather than sending the file
+*   contents the client is told which byte range of DATA_FILE to read.
+*/
+void *shm_ring_thread(void *thread_param)
+{
+    shm_ring_server_t *ring = (shm_ring_server_t *)thread_param;
+    shm_ring_slot_t *slot;
+    // read once, a client may change slot->len under us
+    uint32_t len;
+    // the request, copied out of the slot before it is looked at
+    char req_buf[SHM_RING_SLOT_DATA];
+    int data_fd;
+    int ret;
+    // the reply status, kept here as the client can write the slot's
+    int status;
+    command_t command;
+    // ring clients take turns with connections as a single flow
+    fair_flow_t flow;
+
+    data_fd = open_data_file();
+    if(data_fd == RET_ERROR)
+    {
+        syslog(LOG_ERR,"Data file open failed");
+        return NULL;
+    }
+    fair_flow_init(&flow, 1);
+
+    while((slot = shm_ring_next(ring)) != NULL)
+    {
+        fair_acquire(&fair_sched, &flow);
+        status = RET_SUCCESS;
+        slot->resp_offset = 0;
+        len = slot->len;
+
+        if(len > SHM_RING_SLOT_DATA)
+        {
+            syslog(LOG_ERR,"Shared memory ring request of %u bytes rejected", len);
+            status = EMSGSIZE;
+            len = 0;
+        }
+        // the client can still write the slot, check and store a copy
+        memcpy(req_buf, slot->data, len);
+
+        if(status != RET_SUCCESS)
+        {
+            pthread_mutex_lock(&mutex);
+        }
+        else if((ret = parse_command(req_buf, len, &command)) == RET_ERROR)
+        {
+            // a command frame is never appended as data
+            syslog(LOG_ERR,"ioctl command of %u bytes rejected", len);
+            status = errno;
+            pthread_mutex_lock(&mutex);
+        }
+        else if(command.type == COMMAND_FOLLOW)
+        {
+            // a ring client has nothing to stream to
+            syslog(LOG_ERR,"AESDCHAR_IOCFOLLOW rejected on the shared memory ring");
+            status = EOPNOTSUPP;
+            pthread_mutex_lock(&mutex);
+        }
+        else if(command.type != COMMAND_NONE)
+        {
+            // data_fd is reused across requests, seek from the start
+            lseek(data_fd, 0, SEEK_SET);
+            if(command.type == COMMAND_SEEKTO)
+            {
+                ret = seek_to_record(data_fd, &command.seekto, &mutex);
+            }
+#if (USE_AESD_CHAR_DEVICE == 1)
+            else
+            {
+                ret = seek_after_record(data_fd, command.seekafter);
+            }
+#endif
+            if(ret == RET_SUCCESS)
+            {
+                slot->resp_offset = lseek(data_fd, 0, SEEK_CUR);
+            }
+            else
+            {
+                syslog(LOG_ERR,"ioctl failed");
+            }
+            pthread_mutex_lock(&mutex);
+        }
+        else
+        {
+            pthread_mutex_lock(&mutex);
+            ret = RET_SUCCESS;
+            if(!read_only())
+            {
+                ret = append_data(data_fd, req_buf, len);
+            }
+            if(ret == RET_ERROR)
+            {
+                syslog(LOG_ERR,"File write failed");
+                status = errno;
+            }
+        }
+
+        // committed data the client may read, still under the lock
+        slot->status = status;
+        slot->resp_end = lseek(data_fd, 0, SEEK_END);
+        pthread_mutex_unlock(&mutex);
+        fair_release(&fair_sched, &flow);
+
+        shm_ring_complete(ring, slot);
+    }
+
+    fair_flow_destroy(&flow);
+    close(data_fd);
     return thread_param;
 }
 
@@ -651,21 +1556,45 @@ void global_clean_up()
     syslog(LOG_INFO,"Performing clean up");
 
 	// Close data file
-	ret = close(data_file_fd);
-	if(ret == RET_ERROR)
+	if(data_file_fd != RET_ERROR)
 	{
-		syslog(LOG_ERR,"File close failed");
+		ret = close(data_file_fd);
+		if(ret == RET_ERROR)
+		{
+			syslog(LOG_ERR,"File close failed");
+		}
 	}
 	
 #if (USE_AESD_CHAR_DEVICE != 1)
-	// delete data file
-	ret = unlink(DATA_FILE);
-	if(ret == RET_ERROR)
+	repl_stop();
+
+	// delete data file, unless a successor is still using it or
+	// it is a replica we resume from on the next start
+	if(!handed_off && (repl_leader == NULL))
 	{
-		syslog(LOG_ERR,"File delete failed");
+		ret = unlink(data_file);
+		if(ret == RET_ERROR)
+		{
+			syslog(LOG_ERR,"File delete failed");
+		}
 	}
 #endif
 
+	// stop listening for a successor
+	if(handoff_fd != RET_ERROR)
+	{
+		close(handoff_fd);
+		unlink(handoff_path);
+	}
+
+	// local transports
+	if(unix_socket_fd != RET_ERROR)
+	{
+		close(unix_socket_fd);
+		unlink(unix_socket_path);
+	}
+	stop_shm_ring();
+
     // free the elements from the queue
     while (!SLIST_EMPTY(&head))
     {
@@ -677,20 +1606,210 @@ void global_clean_up()
 
 #if (USE_AESD_CHAR_DEVICE != 1)
     // join timestamp thread
-    pthread_join(timestamp_data.thread_id, NULL);
+    if(timestamp_running)
+    {
+        pthread_join(timestamp_data.thread_id, NULL);
+    }
+    if(handoff_state_started)
+    {
+        pthread_join(handoff_state_thread_id, NULL);
+    }
+#endif
+
+#if (USE_AESD_CHAR_DEVICE != 1)
+    record_index_free(&record_index);
 #endif
 
     // destroy mutex
     pthread_mutex_destroy(&mutex);
+    fair_sched_destroy(&fair_sched);
 	
 	// close socket
-	close(socket_fd);
+	if(socket_fd != RET_ERROR)
+	{
+		close(socket_fd);
+	}
 	
 	// Close syslog
 	syslog(LOG_INFO,"AESD Socket application end");
 	closelog();
 }
 
+#if (USE_AESD_CHAR_DEVICE != 1)
+/*
+*   Open the data file for the timestamp thread and index the
+*   records it already holds, so AESDCHAR_IOCSEEKTO works without
+*   rescanning the file on every request.
+*/
+int setup_record_index()
+{
+    int ret;
+
+    data_file_fd = open_data_file();
+    if(data_file_fd == RET_ERROR)
+    {
+        syslog(LOG_ERR,"Data file open failed");
+        return -1;
+    }
+
+    ret = record_index_init(&record_index);
+    if(ret == RET_ERROR)
+    {
+        syslog(LOG_ERR,"record index init failed");
+        return -1;
+    }
+
+    // taking over: the old instance sends its index once drained
+    if(upgrade_conn_fd != RET_ERROR)
+    {
+        record_index_ready = false;
+        ret = pthread_create(&handoff_state_thread_id, NULL,
+                                handoff_state_thread, NULL);
+        if(ret != 0)
+        {
+            syslog(LOG_ERR,"Handoff state thread create failed");
+            return -1;
+        }
+        handoff_state_started = true;
+        return 0;
+    }
+
+    ret = record_index_build(&record_index, data_file_fd);
+    if(ret == RET_ERROR)
+    {
+        syslog(LOG_ERR,"record index build failed");
+        return -1;
+    }
+    syslog(LOG_INFO,"Indexed %zu records in %s",
+            record_index_records(&record_index), data_file);
+
+    return 0;
+}
+
+/*
+*   Receive the record index from the instance we took over from.
+*   Falls back to scanning the file if the old instance goes away.
+*/
+void *handoff_state_thread(void *thread_param)
+{
+    int ret;
+    record_index_t received;
+
+    ret = record_index_init(&received);
+    if(ret == RET_SUCCESS)
+    {
+        ret = handoff_recv_index(upgrade_conn_fd, &received);
+    }
+    close(upgrade_conn_fd);
+    upgrade_conn_fd = RET_ERROR;
+
+    pthread_mutex_lock(&mutex);
+    if(ret == RET_SUCCESS)
+    {
+        record_index_free(&record_index);
+        record_index = received;
+        // pick up anything written after the state was sent
+        ret = record_index_scan(&record_index, data_file_fd);
+    }
+    else
+    {
+        syslog(LOG_ERR,"Handoff of record index failed, rescanning");
+        record_index_free(&received);
+        ret = record_index_build(&record_index, data_file_fd);
+    }
+    if(ret == RET_ERROR)
+    {
+        syslog(LOG_ERR,"record index build failed");
+    }
+    syslog(LOG_INFO,"Indexed %zu records in %s",
+            record_index_records(&record_index), data_file);
+    record_index_ready = true;
+    pthread_cond_broadcast(&record_index_cond);
+    pthread_mutex_unlock(&mutex);
+
+    return thread_param;
+}
+
+// wait until the record index is complete, caller holds mutex
+void wait_record_index()
+{
+    while(!record_index_ready)
+    {
+        pthread_cond_wait(&record_index_cond, &mutex);
+    }
+}
+
+bool replication_stopping()
+{
+    return terminate_process || handed_off;
+}
+
+// start serving followers (-L) or following a leader (-F)
+int setup_replication()
+{
+    int ret = 0;
+
+    repl_context.mutex = &mutex;
+    repl_context.cond = &repl_cond;
+    repl_context.index = &record_index;
+    repl_context.data_file = data_file;
+    repl_context.open_data = open_data_file;
+    repl_context.append = append_data;
+    repl_context.wait_ready = wait_record_index;
+    repl_context.stopping = replication_stopping;
+
+    if(repl_listen_port != NULL)
+    {
+        ret = repl_leader_start(&repl_context, repl_listen_port);
+        if(ret == RET_ERROR)
+        {
+            syslog(LOG_ERR,"Replication listen on port %s failed", repl_listen_port);
+            return -1;
+        }
+    }
+
+    if(repl_leader != NULL)
+    {
+        ret = repl_follower_start(&repl_context, repl_leader);
+        if(ret == RET_ERROR)
+        {
+            syslog(LOG_ERR,"Following %s failed", repl_leader);
+            return -1;
+        }
+    }
+    return ret;
+}
+#endif
+
+// a replication follower serves reads but does not take writes
+bool read_only()
+{
+#if (USE_AESD_CHAR_DEVICE != 1)
+    return (repl_leader != NULL);
+#else
+    return false;
+#endif
+}
+
+/*
+*   Names of the handoff socket, unix socket and shm ring. Instances
+*   on other ports get their own, e.g. /var/tmp/aesdsocket.sock-9001.
+*/
+void set_local_names()
+{
+    const char *suffix = "";
+    char port_suffix[16];
+
+    if(strcmp(port, PORT) != 0)
+    {
+        snprintf(port_suffix, sizeof(port_suffix), "-%s", port);
+        suffix = port_suffix;
+    }
+    snprintf(handoff_path, sizeof(handoff_path), "%s%s", HANDOFF_PATH, suffix);
+    snprintf(unix_socket_path, sizeof(unix_socket_path), "%s%s", UNIX_SOCKET_PATH, suffix);
+    snprintf(shm_ring_name, sizeof(shm_ring_name), "%s%s", SHM_RING_NAME, suffix);
+}
+
 #if (USE_AESD_CHAR_DEVICE != 1)
 // timestamp struct init
 int setup_timestamp()
@@ -703,11 +1822,12 @@ int setup_timestamp()
     // create and start timestamp thread
     pt_ret = pthread_create(&(timestamp_data.thread_id), NULL, \
                                 timestamp_thread, &(timestamp_data));
-    if(pt_ret == RET_ERROR)
+    if(pt_ret != 0)
     {
         syslog(LOG_ERR, "Timestamp Thread create failed");
         return -1;
     }
+    timestamp_running = true;
 
     return 0;
 }
@@ -749,6 +1869,9 @@ void *timestamp_thread(void *thread_param)
         // using strftime to display time
         int time_len = strftime(time_stamp, sizeof(time_stamp), "timestamp: %Y, %b %d, %H:%M:%S\n", tmp);
 
+        // not cancellable while the lock is held
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
         // acquire lock
         ret = pthread_mutex_lock(thread_ts_data->mutex);
         if(ret == RET_ERROR)
@@ -758,10 +1881,11 @@ void *timestamp_thread(void *thread_param)
         }
 
         // write data to file
-        ret = write(data_file_fd, time_stamp, time_len);
+        ret = append_data(data_file_fd, time_stamp, time_len);
         if(ret == RET_ERROR)
         {
             syslog(LOG_ERR,"File write failed");
+            pthread_mutex_unlock(thread_ts_data->mutex);
             return NULL;
         }
 
@@ -772,6 +1896,7 @@ void *timestamp_thread(void *thread_param)
             syslog(LOG_ERR,"mutex unlock failed");
             return NULL;
         }
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
     }
 
 }
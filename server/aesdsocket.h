@@ -24,6 +24,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netdb.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -33,7 +34,16 @@
 #include <pthread.h>
 #include <sys/queue.h>
 #include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
 #include "../aesd-char-driver/aesd_ioctl.h"
+#include "record_index.h"
+#include "handoff.h"
+#include "shm_ring.h"
+#include "replication.h"
+#include "fair_sched.h"
 
 // Optional: use these functions to add debug or error prints to your application
 #define DEBUG_LOG(msg,...) printf("INFO: " msg "\n" , ##__VA_ARGS__)
@@ -43,17 +53,24 @@
 #define RET_ERROR 		    (-1)
 
 #define PORT                ("9000")
+// same protocol as port 9000 for clients on this host
+#define UNIX_SOCKET_PATH    ("/var/tmp/aesdsocket.sock")
 #define BACKLOG_CONNECTIONS	(10)
 
 #define BUF_LEN		(1024)
+// longest command packet, longer ones are rejected rather than stored
+#define COMMAND_LEN     (64)
+// longest a following connection takes to notice the server stopping
+#define FOLLOW_STOP_CHECK_MS	(1000)
 
 typedef struct
 {
     pthread_t thread_id;
     pthread_mutex_t *mutex;
+    fair_sched_t *sched;
     bool thread_complete;
     int accept_fd;
-    struct sockaddr_storage *client_addr;
+    struct sockaddr_storage client_addr;
 }thread_data_t;
 
 typedef struct node
@@ -74,3 +91,20 @@ typedef struct
 {
     bool success;
 }command_status_t;
+
+// a packet that is a command rather than data, see parse_command()
+typedef enum
+{
+    COMMAND_NONE,
+    COMMAND_SEEKTO,
+    COMMAND_SEEKAFTER,
+    COMMAND_FOLLOW
+}command_type_t;
+
+typedef struct
+{
+    command_type_t type;
+    struct aesd_seekto seekto;
+    // AESDCHAR_IOCSEEKAFTER argument, NUL terminated
+    char seekafter[COMMAND_LEN];
+}command_t;
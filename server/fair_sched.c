@@ -0,0 +1,181 @@
+/***********************************************************************
+ * @file      		fair_sched.c
+ * @version   		0.1
+ * @brief		    Deficit round robin scheduling of data file work
+ *                  across client connections
+ *
+ * @author    		Amey More, Amey.More@Colorado.edu
+ * @date      		Oct 19, 2026
+ *
+ * @institution 	University of Colorado Boulder (UCB)
+ * @course      	ECEN 5713: Advanced Embedded Software Development
+ * @instructor  	Dan Walkes
+ *
+ * @references
+ * M. Shreedhar, G. Varghese, "Efficient Fair Queueing using Deficit
+ * Round Robin", SIGCOMM 1995
+ *
+ * A connection always has work queued while it waits here, so DRR
+ * reduces to serving waiting flows in FIFO order and handing each a
+ * budget of quantum * weight bytes per turn. A flow that wants more
+ * goes back to the end of the queue. A small packet therefore waits
+ * for at most one bounded turn of every other active connection,
+ * however much a bulk client is reading or writing.
+ ************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "fair_sched.h"
+
+#define RET_SUCCESS 		(0)
+#define RET_ERROR 		    (-1)
+
+void fair_sched_init(fair_sched_t *sched, size_t quantum)
+{
+    pthread_mutex_init(&sched->lock, NULL);
+    TAILQ_INIT(&sched->waiting);
+    sched->owner = NULL;
+    sched->quantum = quantum;
+    sched->rule_count = 0;
+}
+
+void fair_sched_destroy(fair_sched_t *sched)
+{
+    pthread_mutex_destroy(&sched->lock);
+}
+
+/*
+*   Parse "<ipv4 address>[/<prefix length>]:<class>". Connections from
+*   a matching address get a turn 2^class times as large.
+*/
+int fair_sched_add_rule(fair_sched_t *sched, const char *rule)
+{
+    char addr_str[INET_ADDRSTRLEN];
+    struct in_addr addr;
+    const char *colon = strrchr(rule, ':');
+    const char *slash;
+    size_t addr_len;
+    unsigned long prefix = 32;
+    unsigned long priority_class;
+    char *end;
+
+    if((colon == NULL) || (sched->rule_count == FAIR_SCHED_MAX_RULES))
+    {
+        return RET_ERROR;
+    }
+
+    slash = memchr(rule, '/', colon - rule);
+    addr_len = ((slash != NULL) ? slash : colon) - rule;
+    if(addr_len >= sizeof(addr_str))
+    {
+        return RET_ERROR;
+    }
+    memcpy(addr_str, rule, addr_len);
+    addr_str[addr_len] = '\0';
+    if(inet_pton(AF_INET, addr_str, &addr) != 1)
+    {
+        return RET_ERROR;
+    }
+
+    if(slash != NULL)
+    {
+        prefix = strtoul(slash + 1, &end, 10);
+        if((end != colon) || (prefix > 32))
+        {
+            return RET_ERROR;
+        }
+    }
+
+    priority_class = strtoul(colon + 1, &end, 10);
+    if((*end != '\0') || (priority_class > FAIR_SCHED_MAX_CLASS))
+    {
+        return RET_ERROR;
+    }
+
+    sched->rules[sched->rule_count].mask = (prefix == 0) ? 0 : htonl(~0u << (32 - prefix));
+    sched->rules[sched->rule_count].addr = addr.s_addr & sched->rules[sched->rule_count].mask;
+    sched->rules[sched->rule_count].priority_class = priority_class;
+    sched->rule_count++;
+    return RET_SUCCESS;
+}
+
+// weight of a client, first matching rule wins, class 0 otherwise
+uint32_t fair_sched_weight(const fair_sched_t *sched, const struct sockaddr_storage *addr)
+{
+    size_t i;
+    uint32_t s_addr;
+
+    if(addr->ss_family != AF_INET)
+    {
+        return 1;
+    }
+
+    s_addr = ((const struct sockaddr_in *)addr)->sin_addr.s_addr;
+    for(i = 0; i < sched->rule_count; i++)
+    {
+        if((s_addr & sched->rules[i].mask) == sched->rules[i].addr)
+        {
+            return 1u << sched->rules[i].priority_class;
+        }
+    }
+    return 1;
+}
+
+void fair_flow_init(fair_flow_t *flow, uint32_t weight)
+{
+    pthread_cond_init(&flow->cond, NULL);
+    flow->weight = weight;
+    flow->granted = false;
+}
+
+void fair_flow_destroy(fair_flow_t *flow)
+{
+    pthread_cond_destroy(&flow->cond);
+}
+
+// wait for this flow's turn, returns how many bytes it may process
+size_t fair_acquire(fair_sched_t *sched, fair_flow_t *flow)
+{
+    pthread_mutex_lock(&sched->lock);
+    if((sched->owner == NULL) && TAILQ_EMPTY(&sched->waiting))
+    {
+        sched->owner = flow;
+    }
+    else
+    {
+        flow->granted = false;
+        TAILQ_INSERT_TAIL(&sched->waiting, flow, nodes);
+        while(!flow->granted)
+        {
+            pthread_cond_wait(&flow->cond, &sched->lock);
+        }
+    }
+    pthread_mutex_unlock(&sched->lock);
+
+    return sched->quantum * flow->weight;
+}
+
+// end this flow's turn and hand the next one to the longest waiter,
+// a flow that does not hold the turn has nothing to hand over
+void fair_release(fair_sched_t *sched, fair_flow_t *flow)
+{
+    fair_flow_t *next;
+
+    pthread_mutex_lock(&sched->lock);
+    if(sched->owner != flow)
+    {
+        pthread_mutex_unlock(&sched->lock);
+        return;
+    }
+    next = TAILQ_FIRST(&sched->waiting);
+    if(next != NULL)
+    {
+        TAILQ_REMOVE(&sched->waiting, next, nodes);
+        next->granted = true;
+        pthread_cond_signal(&next->cond);
+    }
+    sched->owner = next;
+    pthread_mutex_unlock(&sched->lock);
+}
@@ -0,0 +1,69 @@
+/***********************************************************************
+ * @file      		fair_sched.h
+ * @version   		0.1
+ * @brief		    Deficit round robin scheduling of data file work
+ *                  across client connections
+ *
+ * @author    		Amey More, Amey.More@Colorado.edu
+ * @date      		Oct 19, 2026
+ *
+ * @institution 	University of Colorado Boulder (UCB)
+ * @course      	ECEN 5713: Advanced Embedded Software Development
+ * @instructor  	Dan Walkes
+ *
+ ************************************************************************/
+#ifndef FAIR_SCHED_H
+#define FAIR_SCHED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+
+#define FAIR_SCHED_QUANTUM      (4096)
+#define FAIR_SCHED_MAX_CLASS    (3)
+#define FAIR_SCHED_MAX_RULES    (16)
+
+// one per connection, a flow holds at most one turn at a time
+typedef struct fair_flow
+{
+    pthread_cond_t cond;
+    // bytes per turn is quantum * weight
+    uint32_t weight;
+    bool granted;
+
+    TAILQ_ENTRY(fair_flow) nodes;
+}fair_flow_t;
+
+// source address prefix mapped to a priority class
+typedef struct
+{
+    uint32_t addr;
+    uint32_t mask;
+    uint32_t priority_class;
+}fair_rule_t;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    TAILQ_HEAD(fair_queue_s, fair_flow) waiting;
+    // flow whose turn it is, NULL when idle
+    fair_flow_t *owner;
+    size_t quantum;
+    fair_rule_t rules[FAIR_SCHED_MAX_RULES];
+    size_t rule_count;
+}fair_sched_t;
+
+void fair_sched_init(fair_sched_t *sched, size_t quantum);
+void fair_sched_destroy(fair_sched_t *sched);
+int fair_sched_add_rule(fair_sched_t *sched, const char *rule);
+uint32_t fair_sched_weight(const fair_sched_t *sched, const struct sockaddr_storage *addr);
+
+void fair_flow_init(fair_flow_t *flow, uint32_t weight);
+void fair_flow_destroy(fair_flow_t *flow);
+size_t fair_acquire(fair_sched_t *sched, fair_flow_t *flow);
+void fair_release(fair_sched_t *sched, fair_flow_t *flow);
+
+#endif /* FAIR_SCHED_H */
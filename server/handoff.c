@@ -0,0 +1,379 @@
+/***********************************************************************
+ * @file      		handoff.c
+ * @version   		0.1
+ * @brief		    Listening socket and state handoff between an old
+ *                  and a new aesdsocket instance
+ *
+ * @author    		Amey More, Amey.More@Colorado.edu
+ * @date      		Oct 19, 2026
+ *
+ * @institution 	University of Colorado Boulder (UCB)
+ * @course      	ECEN 5713: Advanced Embedded Software Development
+ * @instructor  	Dan Walkes
+ *
+ * @references
+ * https://man7.org/linux/man-pages/man7/unix.7.html (SCM_RIGHTS)
+ *
+ * https://man7.org/linux/man-pages/man3/sd_listen_fds.3.html
+ ************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "handoff.h"
+
+#define RET_SUCCESS 		(0)
+#define RET_ERROR 		    (-1)
+
+/*
+*   Index state sent after the listening socket, once the old
+*   instance has drained. count is the number of entries in start[].
+*/
+typedef struct
+{
+    uint64_t count;
+    int64_t end;
+}handoff_index_hdr_t;
+
+static int fill_unix_addr(struct sockaddr_un *addr, const char *path)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr->sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return RET_ERROR;
+    }
+    strcpy(addr->sun_path, path);
+    return RET_SUCCESS;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *pos = buf;
+    ssize_t ret;
+
+    while(len > 0)
+    {
+        ret = write(fd, pos, len);
+        if(ret == RET_ERROR)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return RET_ERROR;
+        }
+        pos += ret;
+        len -= ret;
+    }
+    return RET_SUCCESS;
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+    char *pos = buf;
+    ssize_t ret;
+
+    while(len > 0)
+    {
+        ret = read(fd, pos, len);
+        if(ret == RET_ERROR)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return RET_ERROR;
+        }
+        if(ret == 0)
+        {
+            errno = ECONNRESET;
+            return RET_ERROR;
+        }
+        pos += ret;
+        len -= ret;
+    }
+    return RET_SUCCESS;
+}
+
+/*
+*   Create the directory holding path with mode 0700, or check that an
+*   existing one belongs to us and no one else can enter it, so only our
+*   user can reach the socket inside.
+*/
+static int private_dir(const char *path)
+{
+    char dir[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    char *slash;
+    struct stat st;
+
+    strcpy(dir, path);
+    slash = strrchr(dir, '/');
+    if((slash == NULL) || (slash == dir))
+    {
+        errno = EINVAL;
+        return RET_ERROR;
+    }
+    *slash = '\0';
+
+    if((mkdir(dir, 0700) == RET_ERROR) && (errno != EEXIST))
+    {
+        return RET_ERROR;
+    }
+    if(lstat(dir, &st) == RET_ERROR)
+    {
+        return RET_ERROR;
+    }
+    if(!S_ISDIR(st.st_mode) || (st.st_uid != geteuid()) || ((st.st_mode & 077) != 0))
+    {
+        errno = EPERM;
+        return RET_ERROR;
+    }
+    return RET_SUCCESS;
+}
+
+// listen for a successor instance on path, replacing a stale socket file
+int handoff_listen(const char *path)
+{
+    int fd;
+    struct sockaddr_un addr;
+
+    if((fill_unix_addr(&addr, path) == RET_ERROR) || (private_dir(path) == RET_ERROR))
+    {
+        return RET_ERROR;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd == RET_ERROR)
+    {
+        return RET_ERROR;
+    }
+
+    unlink(path);
+    // the daemon runs with umask 0, the directory keeps others out until chmod
+    if((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == RET_ERROR) ||
+        (chmod(path, 0600) == RET_ERROR) ||
+        (listen(fd, 1) == RET_ERROR))
+    {
+        close(fd);
+        return RET_ERROR;
+    }
+    return fd;
+}
+
+// accept a successor on listen_fd, only if it runs as our user
+int handoff_accept(int listen_fd)
+{
+    int fd;
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if(fd == RET_ERROR)
+    {
+        return RET_ERROR;
+    }
+
+    if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == RET_ERROR)
+    {
+        close(fd);
+        return RET_ERROR;
+    }
+    if(cred.uid != geteuid())
+    {
+        close(fd);
+        errno = EPERM;
+        return RET_ERROR;
+    }
+    return fd;
+}
+
+// connect to the running instance and request its listening socket
+int handoff_connect(const char *path)
+{
+    int fd;
+    struct sockaddr_un addr;
+
+    if(fill_unix_addr(&addr, path) == RET_ERROR)
+    {
+        return RET_ERROR;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd == RET_ERROR)
+    {
+        return RET_ERROR;
+    }
+
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == RET_ERROR)
+    {
+        close(fd);
+        return RET_ERROR;
+    }
+    return fd;
+}
+
+// pass fd to the peer of conn_fd with SCM_RIGHTS
+int handoff_send_fd(int conn_fd, int fd)
+{
+    char data = 'H';
+    struct iovec iov = { .iov_base = &data, .iov_len = sizeof(data) };
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    }control;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    if(sendmsg(conn_fd, &msg, MSG_NOSIGNAL) == RET_ERROR)
+    {
+        return RET_ERROR;
+    }
+    return RET_SUCCESS;
+}
+
+// receive a descriptor sent with handoff_send_fd()
+int handoff_recv_fd(int conn_fd)
+{
+    int fd = RET_ERROR;
+    char data;
+    struct iovec iov = { .iov_base = &data, .iov_len = sizeof(data) };
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    }control;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    ssize_t ret;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    do
+    {
+        ret = recvmsg(conn_fd, &msg, MSG_CMSG_CLOEXEC);
+    }while((ret == RET_ERROR) && (errno == EINTR));
+    if(ret <= 0)
+    {
+        return RET_ERROR;
+    }
+
+    for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+        {
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    return fd;
+}
+
+int handoff_send_index(int conn_fd, const record_index_t *index)
+{
+    handoff_index_hdr_t hdr;
+
+    hdr.count = index->count;
+    hdr.end = index->end;
+
+    if(write_all(conn_fd, &hdr, sizeof(hdr)) == RET_ERROR)
+    {
+        return RET_ERROR;
+    }
+    return write_all(conn_fd, index->start, index->count * sizeof(off_t));
+}
+
+// replace the contents of index with the state sent by the old instance
+int handoff_recv_index(int conn_fd, record_index_t *index)
+{
+    handoff_index_hdr_t hdr;
+    off_t *start;
+
+    if(read_all(conn_fd, &hdr, sizeof(hdr)) == RET_ERROR)
+    {
+        return RET_ERROR;
+    }
+    // start[0] plus one entry per newline in the peer's file, a larger
+    // count is corrupt and must not size the allocation
+    if((hdr.count == 0) || (hdr.end < 0) || (hdr.count > ((uint64_t)hdr.end + 1)) ||
+        (hdr.count > (SIZE_MAX / sizeof(off_t))))
+    {
+        errno = EPROTO;
+        return RET_ERROR;
+    }
+
+    start = malloc(hdr.count * sizeof(off_t));
+    if(start == NULL)
+    {
+        return RET_ERROR;
+    }
+    if(read_all(conn_fd, start, hdr.count * sizeof(off_t)) == RET_ERROR)
+    {
+        free(start);
+        return RET_ERROR;
+    }
+
+    free(index->start);
+    index->start = start;
+    index->count = hdr.count;
+    index->capacity = hdr.count;
+    index->end = hdr.end;
+    return RET_SUCCESS;
+}
+
+/*
+*   Return the listening socket passed in by a supervisor using the
+*   LISTEN_FDS/LISTEN_PID convention, or -1 if there is none.
+*/
+int inherited_listen_fd()
+{
+    const char *listen_pid = getenv("LISTEN_PID");
+    const char *listen_fds = getenv("LISTEN_FDS");
+    int type;
+    socklen_t len = sizeof(type);
+
+    if((listen_pid == NULL) || (listen_fds == NULL))
+    {
+        return RET_ERROR;
+    }
+    if((atoi(listen_pid) != getpid()) || (atoi(listen_fds) < 1))
+    {
+        return RET_ERROR;
+    }
+
+    // don't pass the descriptors on to our own children
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+
+    if((getsockopt(LISTEN_FDS_START, SOL_SOCKET, SO_TYPE, &type, &len) == RET_ERROR) ||
+        (type != SOCK_STREAM))
+    {
+        return RET_ERROR;
+    }
+    return LISTEN_FDS_START;
+}
@@ -0,0 +1,36 @@
+/***********************************************************************
+ * @file      		handoff.h
+ * @version   		0.1
+ * @brief		    Listening socket and state handoff between an old
+ *                  and a new aesdsocket instance
+ *
+ * @author    		Amey More, Amey.More@Colorado.edu
+ * @date      		Oct 19, 2026
+ *
+ * @institution 	University of Colorado Boulder (UCB)
+ * @course      	ECEN 5713: Advanced Embedded Software Development
+ * @instructor  	Dan Walkes
+ *
+ ************************************************************************/
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include "record_index.h"
+
+// unix domain socket the running instance listens on for a successor,
+// its directory is created for the server's user only, see private_dir()
+#define HANDOFF_PATH        ("/var/tmp/aesdsocket.d/handoff")
+
+// first inherited descriptor, see sd_listen_fds(3)
+#define LISTEN_FDS_START    (3)
+
+int handoff_listen(const char *path);
+int handoff_accept(int listen_fd);
+int handoff_connect(const char *path);
+int handoff_send_fd(int conn_fd, int fd);
+int handoff_recv_fd(int conn_fd);
+int handoff_send_index(int conn_fd, const record_index_t *index);
+int handoff_recv_index(int conn_fd, record_index_t *index);
+int inherited_listen_fd();
+
+#endif /* HANDOFF_H */
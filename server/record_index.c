@@ -0,0 +1,167 @@
+/***********************************************************************
+ * @file      		record_index.c
+ * @version   		0.1
+ * @brief		    In-memory index of record start offsets in the
+ *                  aesdsocket data file
+ *
+ * @author    		Amey More, Amey.More@Colorado.edu
+ * @date      		Oct 19, 2026
+ *
+ * @institution 	University of Colorado Boulder (UCB)
+ * @course      	ECEN 5713: Advanced Embedded Software Development
+ * @instructor  	Dan Walkes
+ *
+ * @references
+ * The startup scan relies on memchr(), which glibc implements with
+ * SSE2/AVX2 (x86) and NEON (aarch64) so the newline search is
+ * vectorized on every target we build for.
+ ************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "record_index.h"
+
+#define RET_SUCCESS 		(0)
+#define RET_ERROR 		    (-1)
+
+#define INITIAL_CAPACITY    (64)
+#define SCAN_BUF_LEN        (64 * 1024)
+
+// add a record start offset, growing the array geometrically
+static int record_index_push(record_index_t *index, off_t start)
+{
+    off_t *new_start;
+    size_t new_capacity;
+
+    if(index->count == index->capacity)
+    {
+        new_capacity = index->capacity * 2;
+        new_start = realloc(index->start, new_capacity * sizeof(off_t));
+        if(new_start == NULL)
+        {
+            return RET_ERROR;
+        }
+        index->start = new_start;
+        index->capacity = new_capacity;
+    }
+
+    index->start[index->count++] = start;
+    return RET_SUCCESS;
+}
+
+// empty index for an empty data file
+int record_index_init(record_index_t *index)
+{
+    index->start = malloc(INITIAL_CAPACITY * sizeof(off_t));
+    if(index->start == NULL)
+    {
+        return RET_ERROR;
+    }
+    index->capacity = INITIAL_CAPACITY;
+    index->count = 1;
+    index->start[0] = 0;
+    index->end = 0;
+    return RET_SUCCESS;
+}
+
+// rebuild the index by scanning fd from the start of the file
+int record_index_build(record_index_t *index, int fd)
+{
+    index->count = 1;
+    index->end = 0;
+
+    return record_index_scan(index, fd);
+}
+
+// extend the index with whatever fd holds past index->end
+int record_index_scan(record_index_t *index, int fd)
+{
+    char *scan_buf;
+    ssize_t bytes_read;
+    int ret = RET_SUCCESS;
+
+    scan_buf = malloc(SCAN_BUF_LEN);
+    if(scan_buf == NULL)
+    {
+        return RET_ERROR;
+    }
+
+    do
+    {
+        bytes_read = pread(fd, scan_buf, SCAN_BUF_LEN, index->end);
+        if(bytes_read == RET_ERROR)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            ret = RET_ERROR;
+            break;
+        }
+
+        ret = record_index_append(index, scan_buf, bytes_read);
+    }while((bytes_read > 0) && (ret == RET_SUCCESS));
+
+    free(scan_buf);
+    return ret;
+}
+
+// account for len bytes of buf written at the current end of file
+int record_index_append(record_index_t *index, const char *buf, size_t len)
+{
+    const char *pos = buf;
+    const char *end = buf + len;
+    const char *newline;
+
+    while((newline = memchr(pos, '\n', end - pos)) != NULL)
+    {
+        if(record_index_push(index, index->end + (newline - buf) + 1) == RET_ERROR)
+        {
+            return RET_ERROR;
+        }
+        pos = newline + 1;
+    }
+
+    index->end += len;
+    return RET_SUCCESS;
+}
+
+/*
+*   Translate (record, record_offset) into a file offset, with the same
+*   validation rules as AESDCHAR_IOCSEEKTO on the char driver.
+*/
+int record_index_lookup(const record_index_t *index, uint32_t record,
+                        uint32_t record_offset, off_t *file_offset)
+{
+    off_t record_len;
+
+    if(record >= record_index_records(index))
+    {
+        return RET_ERROR;
+    }
+
+    record_len = index->start[record + 1] - index->start[record];
+    if(record_offset >= record_len)
+    {
+        return RET_ERROR;
+    }
+
+    *file_offset = index->start[record] + record_offset;
+    return RET_SUCCESS;
+}
+
+// number of complete (newline terminated) records
+size_t record_index_records(const record_index_t *index)
+{
+    return index->count - 1;
+}
+
+void record_index_free(record_index_t *index)
+{
+    free(index->start);
+    index->start = NULL;
+    index->count = 0;
+    index->capacity = 0;
+    index->end = 0;
+}
@@ -0,0 +1,46 @@
+/***********************************************************************
+ * @file      		record_index.h
+ * @version   		0.1
+ * @brief		    In-memory index of record start offsets in the
+ *                  aesdsocket data file
+ *
+ * @author    		Amey More, Amey.More@Colorado.edu
+ * @date      		Oct 19, 2026
+ *
+ * @institution 	University of Colorado Boulder (UCB)
+ * @course      	ECEN 5713: Advanced Embedded Software Development
+ * @instructor  	Dan Walkes
+ *
+ ************************************************************************/
+#ifndef RECORD_INDEX_H
+#define RECORD_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+*   A record is one newline terminated write stored in the data file.
+*   start[i] is the file offset where record i begins, so record i
+*   spans [start[i], start[i+1]). start[0] is always 0 and the last
+*   element is the offset where the next (incomplete) record begins.
+*/
+typedef struct
+{
+    off_t *start;
+    size_t count;
+    size_t capacity;
+    // current end of the data file
+    off_t end;
+}record_index_t;
+
+int record_index_init(record_index_t *index);
+int record_index_build(record_index_t *index, int fd);
+int record_index_scan(record_index_t *index, int fd);
+int record_index_append(record_index_t *index, const char *buf, size_t len);
+int record_index_lookup(const record_index_t *index, uint32_t record,
+                        uint32_t record_offset, off_t *file_offset);
+size_t record_index_records(const record_index_t *index);
+void record_index_free(record_index_t *index);
+
+#endif /* RECORD_INDEX_H */
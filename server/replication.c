@@ -0,0 +1,652 @@
+/***********************************************************************
+ * @file      		replication.c
+ * @version   		0.1
+ * @brief		    Asynchronous log shipping from a leader aesdsocket
+ *                  to follower instances
+ *
+ * @author    		Amey More, Amey.More@Colorado.edu
+ * @date      		Oct 19, 2026
+ *
+ * @institution 	University of Colorado Boulder (UCB)
+ * @course      	ECEN 5713: Advanced Embedded Software Development
+ * @instructor  	Dan Walkes
+ *
+ * The leader never blocks its client path on followers: each follower
+ * has its own thread which waits for the data file to grow, reads the
+ * new bytes back with pread() and streams them in frames of up to
+ * REPL_BATCH bytes, keeping up to REPL_WINDOW bytes unacknowledged.
+ * Since follower data files are byte for byte copies of the leader's,
+ * a follower resumes after a reconnect from the size of its own file.
+ ************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <poll.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "replication.h"
+
+#define RET_SUCCESS 		(0)
+#define RET_ERROR 		    (-1)
+
+// how often blocked replication threads check for shutdown
+#define REPL_POLL_MS        (100)
+#define REPL_RETRY_MS       (1000)
+
+typedef struct repl_thread
+{
+    pthread_t thread_id;
+    repl_context_t *ctx;
+    int fd;
+    // follower progress as seen by the leader
+    uint64_t sent;
+    uint64_t acked;
+    char host[NI_MAXHOST];
+    volatile int done;
+
+    SLIST_ENTRY(repl_thread) nodes;
+}repl_thread_t;
+
+SLIST_HEAD(repl_head_s, repl_thread) repl_head = SLIST_HEAD_INITIALIZER(repl_head);
+static pthread_mutex_t repl_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int leader_fd = -1;
+static volatile int leader_closing = 0;
+static bool accept_started = false;
+static pthread_t accept_thread_id;
+static bool follower_started = false;
+static pthread_t follower_thread_id;
+static repl_context_t *follower_ctx;
+static char leader_host[NI_MAXHOST];
+static char leader_port[NI_MAXSERV];
+
+static void sleep_ms(long ms)
+{
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000 };
+
+    nanosleep(&ts, NULL);
+}
+
+// send every iovec completely
+static int send_all(int fd, struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg;
+    ssize_t ret;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    while(msg.msg_iovlen > 0)
+    {
+        ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if(ret == RET_ERROR)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return RET_ERROR;
+        }
+
+        // skip what was sent
+        while((msg.msg_iovlen > 0) && ((size_t)ret >= msg.msg_iov->iov_len))
+        {
+            ret -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if(msg.msg_iovlen > 0)
+        {
+            msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + ret;
+            msg.msg_iov->iov_len -= ret;
+        }
+    }
+    return RET_SUCCESS;
+}
+
+// receive len bytes on a socket with a receive timeout, giving up on shutdown
+static int recv_all(repl_context_t *ctx, int fd, void *buf, size_t len)
+{
+    char *pos = buf;
+    ssize_t ret;
+
+    while(len > 0)
+    {
+        ret = recv(fd, pos, len, 0);
+        if(ret == RET_ERROR)
+        {
+            if((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                if(ctx->stopping())
+                {
+                    return RET_ERROR;
+                }
+                continue;
+            }
+            return RET_ERROR;
+        }
+        if(ret == 0)
+        {
+            errno = ECONNRESET;
+            return RET_ERROR;
+        }
+        pos += ret;
+        len -= ret;
+    }
+    return RET_SUCCESS;
+}
+
+static int pread_all(int fd, char *buf, size_t len, off_t offset)
+{
+    ssize_t ret;
+
+    while(len > 0)
+    {
+        ret = pread(fd, buf, len, offset);
+        if(ret <= 0)
+        {
+            if((ret == RET_ERROR) && (errno == EINTR))
+            {
+                continue;
+            }
+            return RET_ERROR;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return RET_SUCCESS;
+}
+
+static int send_frame(int fd, uint32_t magic, uint64_t offset, const char *buf, uint32_t len)
+{
+    repl_frame_t hdr;
+    struct iovec iov[2];
+
+    hdr.magic = htobe32(magic);
+    hdr.len = htobe32(len);
+    hdr.offset = htobe64(offset);
+
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = (void *)buf;
+    iov[1].iov_len = len;
+    return send_all(fd, iov, (len > 0) ? 2 : 1);
+}
+
+static void set_recv_timeout(int fd)
+{
+    struct timeval tv = { .tv_sec = 0, .tv_usec = REPL_POLL_MS * 1000 };
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+// read whatever acknowledgements have arrived, waiting up to timeout_ms
+static int leader_read_acks(repl_thread_t *follower, char *ack_buf, size_t *ack_len, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = follower->fd, .events = POLLIN };
+    uint64_t ack;
+    ssize_t ret;
+
+    if(poll(&pfd, 1, timeout_ms) <= 0)
+    {
+        return RET_SUCCESS;
+    }
+
+    while(1)
+    {
+        ret = recv(follower->fd, ack_buf + *ack_len, sizeof(uint64_t) - *ack_len, MSG_DONTWAIT);
+        if(ret == RET_ERROR)
+        {
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ?
+                        RET_SUCCESS : RET_ERROR;
+        }
+        if(ret == 0)
+        {
+            return RET_ERROR;
+        }
+
+        *ack_len += ret;
+        if(*ack_len == sizeof(uint64_t))
+        {
+            memcpy(&ack, ack_buf, sizeof(ack));
+            ack = be64toh(ack);
+            if((ack > follower->acked) && (ack <= follower->sent))
+            {
+                follower->acked = ack;
+            }
+            *ack_len = 0;
+        }
+    }
+}
+
+// stream the data file to one follower
+static void *leader_follower_thread(void *thread_param)
+{
+    repl_thread_t *follower = (repl_thread_t *)thread_param;
+    repl_context_t *ctx = follower->ctx;
+    repl_frame_t hello;
+    struct timespec deadline;
+    uint64_t end;
+    size_t len;
+    char *buf = NULL;
+    char ack_buf[sizeof(uint64_t)];
+    size_t ack_len = 0;
+    int data_fd = RET_ERROR;
+    int ret = RET_SUCCESS;
+
+    set_recv_timeout(follower->fd);
+    if((recv_all(ctx, follower->fd, &hello, sizeof(hello)) == RET_ERROR) ||
+        (be32toh(hello.magic) != REPL_HELLO_MAGIC))
+    {
+        syslog(LOG_ERR,"Replication handshake from %s failed", follower->host);
+        goto out;
+    }
+    follower->sent = be64toh(hello.offset);
+    follower->acked = follower->sent;
+
+    pthread_mutex_lock(ctx->mutex);
+    ctx->wait_ready();
+    end = ctx->index->end;
+    pthread_mutex_unlock(ctx->mutex);
+
+    if(follower->sent > end)
+    {
+        syslog(LOG_ERR,"Follower %s is ahead of the leader (%llu > %llu)", follower->host,
+                (unsigned long long)follower->sent, (unsigned long long)end);
+        goto out;
+    }
+    syslog(LOG_INFO,"Follower %s resuming at offset %llu", follower->host,
+            (unsigned long long)follower->sent);
+
+    data_fd = open(ctx->data_file, O_RDONLY);
+    buf = malloc(REPL_BATCH);
+    if((data_fd == RET_ERROR) || (buf == NULL))
+    {
+        syslog(LOG_ERR,"Replication setup for %s failed", follower->host);
+        goto out;
+    }
+
+    while(!ctx->stopping() && (ret == RET_SUCCESS))
+    {
+        // wait for committed data the follower has not been sent
+        pthread_mutex_lock(ctx->mutex);
+        while((ctx->index->end <= (off_t)follower->sent) && !ctx->stopping())
+        {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += REPL_POLL_MS * 1000000;
+            if(deadline.tv_nsec >= 1000000000)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            if(pthread_cond_timedwait(ctx->cond, ctx->mutex, &deadline) == ETIMEDOUT)
+            {
+                break;
+            }
+        }
+        end = ctx->index->end;
+        pthread_mutex_unlock(ctx->mutex);
+
+        // pipeline batches up to the window
+        while((follower->sent < end) && ((follower->sent - follower->acked) < REPL_WINDOW))
+        {
+            len = end - follower->sent;
+            if(len > REPL_BATCH)
+            {
+                len = REPL_BATCH;
+            }
+            if(len > (REPL_WINDOW - (follower->sent - follower->acked)))
+            {
+                len = REPL_WINDOW - (follower->sent - follower->acked);
+            }
+
+            if((pread_all(data_fd, buf, len, follower->sent) == RET_ERROR) ||
+                (send_frame(follower->fd, REPL_DATA_MAGIC, follower->sent, buf, len) == RET_ERROR))
+            {
+                ret = RET_ERROR;
+                break;
+            }
+            follower->sent += len;
+        }
+
+        if(ret == RET_SUCCESS)
+        {
+            // only block for acks when the window is full
+            ret = leader_read_acks(follower, ack_buf, &ack_len,
+                    ((follower->sent - follower->acked) >= REPL_WINDOW) ? REPL_POLL_MS : 0);
+        }
+    }
+
+out:
+    syslog(LOG_INFO,"Follower %s disconnected, acknowledged offset %llu", follower->host,
+            (unsigned long long)follower->acked);
+    free(buf);
+    if(data_fd != RET_ERROR)
+    {
+        close(data_fd);
+    }
+    close(follower->fd);
+    follower->done = 1;
+    return thread_param;
+}
+
+// join follower threads that have disconnected
+static void reap_followers()
+{
+    repl_thread_t *follower;
+    repl_thread_t *next;
+
+    pthread_mutex_lock(&repl_list_mutex);
+    follower = SLIST_FIRST(&repl_head);
+    while(follower != NULL)
+    {
+        next = SLIST_NEXT(follower, nodes);
+        if(follower->done)
+        {
+            pthread_join(follower->thread_id, NULL);
+            SLIST_REMOVE(&repl_head, follower, repl_thread, nodes);
+            free(follower);
+        }
+        follower = next;
+    }
+    pthread_mutex_unlock(&repl_list_mutex);
+}
+
+// accept followers until the leader is closed or aesdsocket stops
+static void *leader_accept_thread(void *thread_param)
+{
+    repl_context_t *ctx = (repl_context_t *)thread_param;
+    struct pollfd pfd;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    repl_thread_t *follower;
+    int fd;
+
+    while(!ctx->stopping() && !leader_closing)
+    {
+        reap_followers();
+
+        pfd.fd = leader_fd;
+        pfd.events = POLLIN;
+        if(poll(&pfd, 1, REPL_POLL_MS) <= 0)
+        {
+            continue;
+        }
+
+        addrlen = sizeof(addr);
+        fd = accept(leader_fd, (struct sockaddr *)&addr, &addrlen);
+        if(fd == RET_ERROR)
+        {
+            continue;
+        }
+
+        follower = calloc(1, sizeof(repl_thread_t));
+        if(follower == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        follower->ctx = ctx;
+        follower->fd = fd;
+        getnameinfo((struct sockaddr *)&addr, addrlen, follower->host, sizeof(follower->host),
+                    NULL, 0, NI_NUMERICHOST);
+
+        if(pthread_create(&follower->thread_id, NULL, leader_follower_thread, follower) != 0)
+        {
+            syslog(LOG_ERR,"Replication thread create failed");
+            close(fd);
+            free(follower);
+            continue;
+        }
+
+        pthread_mutex_lock(&repl_list_mutex);
+        SLIST_INSERT_HEAD(&repl_head, follower, nodes);
+        pthread_mutex_unlock(&repl_list_mutex);
+    }
+
+    return thread_param;
+}
+
+// listen for followers on port
+int repl_leader_start(repl_context_t *ctx, const char *port)
+{
+    struct addrinfo hints;
+    struct addrinfo *result;
+    int yes = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    if(getaddrinfo(NULL, port, &hints, &result) != 0)
+    {
+        return RET_ERROR;
+    }
+
+    leader_fd = socket(result->ai_family, result->ai_socktype | SOCK_CLOEXEC, result->ai_protocol);
+    if(leader_fd == RET_ERROR)
+    {
+        freeaddrinfo(result);
+        return RET_ERROR;
+    }
+    setsockopt(leader_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    if((bind(leader_fd, result->ai_addr, result->ai_addrlen) == RET_ERROR) ||
+        (listen(leader_fd, 4) == RET_ERROR))
+    {
+        freeaddrinfo(result);
+        close(leader_fd);
+        leader_fd = RET_ERROR;
+        return RET_ERROR;
+    }
+    freeaddrinfo(result);
+
+    leader_closing = 0;
+    if(pthread_create(&accept_thread_id, NULL, leader_accept_thread, ctx) != 0)
+    {
+        close(leader_fd);
+        leader_fd = RET_ERROR;
+        return RET_ERROR;
+    }
+    accept_started = true;
+    syslog(LOG_INFO,"Replication leader listening on port %s", port);
+    return RET_SUCCESS;
+}
+
+// stop accepting followers and free the port for a successor
+void repl_leader_close()
+{
+    if(!accept_started)
+    {
+        return;
+    }
+
+    leader_closing = 1;
+    pthread_join(accept_thread_id, NULL);
+    accept_started = false;
+    close(leader_fd);
+    leader_fd = RET_ERROR;
+}
+
+static int connect_leader()
+{
+    struct addrinfo hints;
+    struct addrinfo *result;
+    int fd;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(leader_host, leader_port, &hints, &result) != 0)
+    {
+        return RET_ERROR;
+    }
+
+    fd = socket(result->ai_family, result->ai_socktype | SOCK_CLOEXEC, result->ai_protocol);
+    if((fd != RET_ERROR) && (connect(fd, result->ai_addr, result->ai_addrlen) == RET_ERROR))
+    {
+        close(fd);
+        fd = RET_ERROR;
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+// apply frames from the leader to the local data file, reconnecting as needed
+static void *follower_thread(void *thread_param)
+{
+    repl_context_t *ctx = follower_ctx;
+    repl_frame_t hdr;
+    uint64_t offset;
+    uint64_t ack;
+    struct iovec iov;
+    char *buf;
+    int data_fd;
+    int fd;
+    int ret;
+    int retry_ms;
+
+    buf = malloc(REPL_BATCH);
+    data_fd = ctx->open_data();
+    if((buf == NULL) || (data_fd == RET_ERROR))
+    {
+        syslog(LOG_ERR,"Follower setup failed");
+        free(buf);
+        return NULL;
+    }
+
+    while(!ctx->stopping())
+    {
+        fd = connect_leader();
+        if(fd == RET_ERROR)
+        {
+            for(retry_ms = 0; (retry_ms < REPL_RETRY_MS) && !ctx->stopping(); retry_ms += REPL_POLL_MS)
+            {
+                sleep_ms(REPL_POLL_MS);
+            }
+            continue;
+        }
+        set_recv_timeout(fd);
+
+        // resume from whatever we already hold
+        pthread_mutex_lock(ctx->mutex);
+        ctx->wait_ready();
+        offset = ctx->index->end;
+        pthread_mutex_unlock(ctx->mutex);
+
+        syslog(LOG_INFO,"Following %s:%s from offset %llu", leader_host, leader_port,
+                (unsigned long long)offset);
+        ret = send_frame(fd, REPL_HELLO_MAGIC, offset, NULL, 0);
+
+        while((ret == RET_SUCCESS) && !ctx->stopping())
+        {
+            ret = recv_all(ctx, fd, &hdr, sizeof(hdr));
+            if(ret == RET_ERROR)
+            {
+                break;
+            }
+            hdr.magic = be32toh(hdr.magic);
+            hdr.len = be32toh(hdr.len);
+            hdr.offset = be64toh(hdr.offset);
+            if((hdr.magic != REPL_DATA_MAGIC) || (hdr.len > REPL_BATCH) || (hdr.offset != offset))
+            {
+                syslog(LOG_ERR,"Unexpected replication frame at offset %llu",
+                        (unsigned long long)hdr.offset);
+                ret = RET_ERROR;
+                break;
+            }
+
+            ret = recv_all(ctx, fd, buf, hdr.len);
+            if(ret == RET_ERROR)
+            {
+                break;
+            }
+
+            pthread_mutex_lock(ctx->mutex);
+            ret = ctx->append(data_fd, buf, hdr.len);
+            offset = ctx->index->end;
+            pthread_mutex_unlock(ctx->mutex);
+            if(ret == RET_ERROR)
+            {
+                syslog(LOG_ERR,"Follower write failed");
+                break;
+            }
+
+            ack = htobe64(offset);
+            iov.iov_base = &ack;
+            iov.iov_len = sizeof(ack);
+            ret = send_all(fd, &iov, 1);
+        }
+
+        close(fd);
+        if(!ctx->stopping())
+        {
+            syslog(LOG_INFO,"Lost leader %s:%s, reconnecting", leader_host, leader_port);
+        }
+    }
+
+    close(data_fd);
+    free(buf);
+    return thread_param;
+}
+
+// follow the leader at host:port
+int repl_follower_start(repl_context_t *ctx, const char *leader)
+{
+    const char *colon = strrchr(leader, ':');
+
+    if((colon == NULL) || ((size_t)(colon - leader) >= sizeof(leader_host)) ||
+        (strlen(colon + 1) >= sizeof(leader_port)))
+    {
+        syslog(LOG_ERR,"Leader must be given as host:port");
+        return RET_ERROR;
+    }
+    memcpy(leader_host, leader, colon - leader);
+    leader_host[colon - leader] = '\0';
+    strcpy(leader_port, colon + 1);
+
+    follower_ctx = ctx;
+    if(pthread_create(&follower_thread_id, NULL, follower_thread, NULL) != 0)
+    {
+        return RET_ERROR;
+    }
+    follower_started = true;
+    return RET_SUCCESS;
+}
+
+// wait for every replication thread, ctx->stopping() must already be true
+void repl_stop()
+{
+    repl_thread_t *follower;
+
+    repl_leader_close();
+
+    pthread_mutex_lock(&repl_list_mutex);
+    while(!SLIST_EMPTY(&repl_head))
+    {
+        follower = SLIST_FIRST(&repl_head);
+        SLIST_REMOVE_HEAD(&repl_head, nodes);
+        pthread_mutex_unlock(&repl_list_mutex);
+        pthread_join(follower->thread_id, NULL);
+        free(follower);
+        pthread_mutex_lock(&repl_list_mutex);
+    }
+    pthread_mutex_unlock(&repl_list_mutex);
+
+    if(follower_started)
+    {
+        pthread_join(follower_thread_id, NULL);
+        follower_started = false;
+    }
+}
@@ -0,0 +1,66 @@
+/***********************************************************************
+ * @file      		replication.h
+ * @version   		0.1
+ * @brief		    Asynchronous log shipping from a leader aesdsocket
+ *                  to follower instances
+ *
+ * @author    		Amey More, Amey.More@Colorado.edu
+ * @date      		Oct 19, 2026
+ *
+ * @institution 	University of Colorado Boulder (UCB)
+ * @course      	ECEN 5713: Advanced Embedded Software Development
+ * @instructor  	Dan Walkes
+ *
+ ************************************************************************/
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "record_index.h"
+
+#define REPL_HELLO_MAGIC    (0x52504c48)    // "RPLH"
+#define REPL_DATA_MAGIC     (0x52504c44)    // "RPLD"
+// largest frame the leader sends
+#define REPL_BATCH          (64 * 1024)
+// bytes the leader sends ahead of the follower's last ack
+#define REPL_WINDOW         (1024 * 1024)
+
+/*
+*   Every leader to follower message starts with this header, in
+*   network byte order. offset is the data file offset of the payload.
+*   A follower opens with a REPL_HELLO_MAGIC header (len 0) carrying
+*   the offset to resume from, then acknowledges by sending its new
+*   data file size as a big endian uint64_t after each frame.
+*/
+typedef struct
+{
+    uint32_t magic;
+    uint32_t len;
+    uint64_t offset;
+}repl_frame_t;
+
+/*
+*   What replication needs from aesdsocket. The leader waits on cond,
+*   which aesdsocket broadcasts after every append, and both sides
+*   read index->end under mutex.
+*/
+typedef struct
+{
+    pthread_mutex_t *mutex;
+    pthread_cond_t *cond;
+    record_index_t *index;
+    const char *data_file;
+    int (*open_data)();
+    int (*append)(int fd, const char *buf, size_t len);
+    void (*wait_ready)();
+    bool (*stopping)();
+}repl_context_t;
+
+int repl_leader_start(repl_context_t *ctx, const char *port);
+void repl_leader_close();
+int repl_follower_start(repl_context_t *ctx, const char *leader);
+void repl_stop();
+
+#endif /* REPLICATION_H */
@@ -0,0 +1,441 @@
+/***********************************************************************
+ * @file      		shm_ring.c
+ * @version   		0.1
+ * @brief		    Shared memory request ring for clients running on
+ *                  the same host as aesdsocket
+ *
+ * @author    		Amey More, Amey.More@Colorado.edu
+ * @date      		Oct 19, 2026
+ *
+ * @institution 	University of Colorado Boulder (UCB)
+ * @course      	ECEN 5713: Advanced Embedded Software Development
+ * @instructor  	Dan Walkes
+ *
+ * @references
+ * Bounded MPMC queue, Dmitry Vyukov
+ * https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ *
+ * https://man7.org/linux/man-pages/man2/futex.2.html
+ ************************************************************************/
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shm_ring.h"
+
+#define RET_SUCCESS 		(0)
+#define RET_ERROR 		    (-1)
+
+// clients re-check for a dead server this often while waiting
+#define CLIENT_WAIT_NS      (100 * 1000 * 1000)
+
+// shared (not FUTEX_PRIVATE) futexes, the words live in a shm mapping
+static void futex_wait(_Atomic uint32_t *word, uint32_t val, const struct timespec *timeout)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *word, int count)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+static size_t shm_ring_size(uint32_t slot_count)
+{
+    return sizeof(shm_ring_t) + (slot_count * sizeof(shm_ring_slot_t));
+}
+
+static uint64_t monotonic_ns()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000ull) + now.tv_nsec;
+}
+
+/*
+*   Create (or replace) the ring, slot_count must be a power of two.
+*   Only the server's user and group may open it.
+*/
+shm_ring_server_t *shm_ring_create(const char *name, uint32_t slot_count)
+{
+    int fd;
+    uint32_t i;
+    size_t size = shm_ring_size(slot_count);
+    shm_ring_server_t *server;
+    shm_ring_t *ring;
+
+    if((slot_count == 0) || ((slot_count & (slot_count - 1)) != 0))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    server = calloc(1, sizeof(*server));
+    if(server == NULL)
+    {
+        return NULL;
+    }
+
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0660);
+    if(fd == RET_ERROR)
+    {
+        free(server);
+        return NULL;
+    }
+    // the same mode whatever the umask
+    fchmod(fd, 0660);
+
+    if(ftruncate(fd, size) == RET_ERROR)
+    {
+        close(fd);
+        shm_unlink(name);
+        free(server);
+        return NULL;
+    }
+
+    ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ring == MAP_FAILED)
+    {
+        shm_unlink(name);
+        free(server);
+        return NULL;
+    }
+
+    ring->slot_count = slot_count;
+    atomic_init(&ring->shutdown, 0);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->doorbell, 0);
+    atomic_init(&ring->server_waiting, 0);
+    atomic_init(&ring->room, 0);
+    atomic_init(&ring->room_waiting, 0);
+    for(i = 0; i < slot_count; i++)
+    {
+        atomic_init(&ring->slots[i].seq, i);
+        atomic_init(&ring->slots[i].done, 0);
+    }
+    // clients check the magic, publish it last
+    atomic_thread_fence(memory_order_release);
+    ring->magic = SHM_RING_MAGIC;
+
+    server->shared = ring;
+    server->slot_count = slot_count;
+    return server;
+}
+
+// let clients waiting for a full ring retry
+static void shm_ring_room(shm_ring_t *ring)
+{
+    atomic_fetch_add(&ring->room, 1);
+    if(atomic_load(&ring->room_waiting))
+    {
+        futex_wake(&ring->room, INT_MAX);
+    }
+}
+
+/*
+*   Take back the slot at pos if a client has held it too long, e.g.
+*   because it exited: reserved without publishing it for
+*   SHM_RING_PUBLISH_NS, or, from the lap before, answered without
+*   releasing it for SHM_RING_COLLECT_NS. Taking the slot with the same
+*   compare and swap the client publishes or releases with means exactly
+*   one of the two wins.
+*   Returns true if a reserved slot was skipped.
+*/
+static bool shm_ring_reclaim(shm_ring_server_t *server, shm_ring_slot_t *slot, uint64_t pos)
+{
+    shm_ring_t *ring = server->shared;
+    uint64_t seq = atomic_load(&slot->seq);
+    uint64_t expected;
+    uint64_t limit;
+    uint64_t now;
+
+    if((seq == pos) && (atomic_load(&ring->head) > pos))
+    {
+        // reserved, will be skipped
+        expected = pos;
+        limit = SHM_RING_PUBLISH_NS;
+    }
+    else if((pos >= server->slot_count) && (seq == (pos - server->slot_count + 1)))
+    {
+        // answered, will be released for the client reserving pos
+        expected = seq;
+        limit = SHM_RING_COLLECT_NS;
+    }
+    else
+    {
+        server->held_since_ns = 0;
+        return false;
+    }
+
+    now = monotonic_ns();
+    if(server->held_since_ns == 0)
+    {
+        server->held_since_ns = now;
+        return false;
+    }
+    if((now - server->held_since_ns) < limit)
+    {
+        return false;
+    }
+
+    server->held_since_ns = 0;
+    if(expected == pos)
+    {
+        if(!atomic_compare_exchange_strong(&slot->seq, &expected, pos + server->slot_count))
+        {
+            // published meanwhile
+            return false;
+        }
+        atomic_fetch_add_explicit(&ring->tail, 1, memory_order_relaxed);
+        shm_ring_room(ring);
+        return true;
+    }
+
+    if(atomic_compare_exchange_strong(&slot->seq, &expected, pos))
+    {
+        shm_ring_room(ring);
+    }
+    return false;
+}
+
+/*
+*   Wait for the next published request. Only one server thread may
+*   call this. Returns NULL once shm_ring_stop() has been called.
+*/
+shm_ring_slot_t *shm_ring_next(shm_ring_server_t *server)
+{
+    shm_ring_t *ring = server->shared;
+    uint64_t pos;
+    shm_ring_slot_t *slot;
+    uint32_t bell;
+    struct timespec timeout = { .tv_sec = 0, .tv_nsec = SHM_RING_PUBLISH_NS / 10 };
+
+    while(1)
+    {
+        pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        slot = &ring->slots[pos & (server->slot_count - 1)];
+        if(atomic_load(&slot->seq) == (pos + 1))
+        {
+            server->held_since_ns = 0;
+            return slot;
+        }
+        if(atomic_load(&ring->shutdown))
+        {
+            return NULL;
+        }
+        if(shm_ring_reclaim(server, slot, pos))
+        {
+            continue;
+        }
+
+        // announce we are going to sleep, then check once more, waking
+        // up now and then while a client holds the slot
+        bell = atomic_load(&ring->doorbell);
+        atomic_store(&ring->server_waiting, 1);
+        if((atomic_load(&slot->seq) != (pos + 1)) && !atomic_load(&ring->shutdown))
+        {
+            futex_wait(&ring->doorbell, bell, (server->held_since_ns != 0) ? &timeout : NULL);
+        }
+        atomic_store(&ring->server_waiting, 0);
+    }
+}
+
+// publish the response for the slot returned by shm_ring_next()
+void shm_ring_complete(shm_ring_server_t *server, shm_ring_slot_t *slot)
+{
+    atomic_store_explicit(&slot->done, 1, memory_order_release);
+    futex_wake(&slot->done, 1);
+    atomic_fetch_add_explicit(&server->shared->tail, 1, memory_order_relaxed);
+}
+
+// stop serving, wake the server thread and every waiting client
+void shm_ring_stop(shm_ring_server_t *server)
+{
+    shm_ring_t *ring = server->shared;
+    uint32_t i;
+
+    atomic_store(&ring->shutdown, 1);
+    atomic_fetch_add(&ring->doorbell, 1);
+    futex_wake(&ring->doorbell, INT_MAX);
+    atomic_fetch_add(&ring->room, 1);
+    futex_wake(&ring->room, INT_MAX);
+    for(i = 0; i < server->slot_count; i++)
+    {
+        futex_wake(&ring->slots[i].done, INT_MAX);
+    }
+}
+
+void shm_ring_destroy(shm_ring_server_t *server, const char *name)
+{
+    if(name != NULL)
+    {
+        shm_unlink(name);
+    }
+    munmap(server->shared, shm_ring_size(server->slot_count));
+    free(server);
+}
+
+shm_ring_t *shm_ring_attach(const char *name)
+{
+    int fd;
+    struct stat st;
+    shm_ring_t *ring;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if(fd == RET_ERROR)
+    {
+        return NULL;
+    }
+    if((fstat(fd, &st) == RET_ERROR) || (st.st_size < (off_t)sizeof(shm_ring_t)))
+    {
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    ring = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ring == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    if((ring->magic != SHM_RING_MAGIC) ||
+        ((size_t)st.st_size != shm_ring_size(ring->slot_count)))
+    {
+        munmap(ring, st.st_size);
+        errno = EPROTO;
+        return NULL;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    return ring;
+}
+
+/*
+*   Submit one packet and wait for it to be committed. On success the
+*   server's answer is the content of DATA_FILE in [resp_offset, resp_end).
+*/
+int shm_ring_request(shm_ring_t *ring, const char *buf, size_t len,
+                        int64_t *resp_offset, int64_t *resp_end)
+{
+    uint64_t pos;
+    uint64_t seq;
+    int64_t diff;
+    int status;
+    uint32_t room;
+    shm_ring_slot_t *slot;
+    struct timespec timeout = { .tv_sec = 0, .tv_nsec = CLIENT_WAIT_NS };
+
+    if(len > SHM_RING_SLOT_DATA)
+    {
+        errno = EMSGSIZE;
+        return RET_ERROR;
+    }
+
+    // reserve a slot
+    pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while(1)
+    {
+        if(atomic_load(&ring->shutdown))
+        {
+            errno = ESHUTDOWN;
+            return RET_ERROR;
+        }
+
+        slot = &ring->slots[pos & (ring->slot_count - 1)];
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        diff = (int64_t)(seq - pos);
+        if(diff == 0)
+        {
+            if(atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1,
+                        memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if(diff < 0)
+        {
+            // ring full, sleep until a slot is released, then check once
+            // more, waking up now and then to see if the server is gone
+            room = atomic_load(&ring->room);
+            atomic_fetch_add(&ring->room_waiting, 1);
+            if(((int64_t)(atomic_load(&slot->seq) - pos) < 0) && !atomic_load(&ring->shutdown))
+            {
+                futex_wait(&ring->room, room, &timeout);
+            }
+            atomic_fetch_sub(&ring->room_waiting, 1);
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+        else
+        {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+
+    // fill and publish, unless the server gave up on the slot meanwhile
+    memcpy(slot->data, buf, len);
+    slot->len = len;
+    atomic_store_explicit(&slot->done, 0, memory_order_relaxed);
+    seq = pos;
+    if(!atomic_compare_exchange_strong(&slot->seq, &seq, pos + 1))
+    {
+        errno = ETIMEDOUT;
+        return RET_ERROR;
+    }
+
+    // ring the doorbell
+    atomic_fetch_add(&ring->doorbell, 1);
+    if(atomic_load(&ring->server_waiting))
+    {
+        futex_wake(&ring->doorbell, 1);
+    }
+
+    // wait for the commit
+    while(atomic_load_explicit(&slot->done, memory_order_acquire) == 0)
+    {
+        if(atomic_load(&ring->shutdown))
+        {
+            errno = ESHUTDOWN;
+            return RET_ERROR;
+        }
+        futex_wait(&slot->done, 0, &timeout);
+    }
+
+    status = slot->status;
+    *resp_offset = slot->resp_offset;
+    *resp_end = slot->resp_end;
+
+    // release the slot for the producer one lap ahead, unless the server
+    // took it back meanwhile and the response may be another client's
+    seq = pos + 1;
+    if(!atomic_compare_exchange_strong(&slot->seq, &seq, pos + ring->slot_count))
+    {
+        errno = ETIMEDOUT;
+        return RET_ERROR;
+    }
+    shm_ring_room(ring);
+
+    if(status != RET_SUCCESS)
+    {
+        errno = status;
+        return RET_ERROR;
+    }
+    return RET_SUCCESS;
+}
+
+void shm_ring_detach(shm_ring_t *ring)
+{
+    munmap(ring, shm_ring_size(ring->slot_count));
+}
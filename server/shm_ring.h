@@ -0,0 +1,103 @@
+/***********************************************************************
+ * @file      		shm_ring.h
+ * @version   		0.1
+ * @brief		    Shared memory request ring for clients running on
+ *                  the same host as aesdsocket
+ *
+ * @author    		Amey More, Amey.More@Colorado.edu
+ * @date      		Oct 19, 2026
+ *
+ * @institution 	University of Colorado Boulder (UCB)
+ * @course      	ECEN 5713: Advanced Embedded Software Development
+ * @instructor  	Dan Walkes
+ *
+ ************************************************************************/
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <signal.h>
+
+#define SHM_RING_NAME       ("/aesdsocket")
+#define SHM_RING_MAGIC      (0x41455344)
+#define SHM_RING_SLOTS      (64)            // must be a power of two
+#define SHM_RING_SLOT_DATA  (4096)
+// a slot reserved this long without being published is skipped
+#define SHM_RING_PUBLISH_NS (1000ull * 1000 * 1000)
+// a slot answered this long ago without being released is taken back
+#define SHM_RING_COLLECT_NS (1000ull * 1000 * 1000)
+
+/*
+*   One request. Clients reserve a slot, copy a packet into data and
+*   publish it by moving seq from pos to pos + 1. The server may instead
+*   move it to pos + slot_count if the client took too long, which fails
+*   the client's publish. aesdsocket handles it exactly
+*   like a packet received on port 9000 and, instead of sending the
+*   file back, stores the byte range the client should read from
+*   DATA_FILE in resp_offset/resp_end and sets done. The client frees
+*   the slot by moving seq from pos + 1 to pos + slot_count. The server
+*   does that itself if the client took too long, which fails the
+*   client's release.
+*/
+typedef struct
+{
+    _Atomic uint64_t seq;
+    // futex word, 1 once the response fields are valid
+    _Atomic uint32_t done;
+    uint32_t len;
+    int32_t status;
+    int32_t reserved;
+    int64_t resp_offset;
+    int64_t resp_end;
+    char data[SHM_RING_SLOT_DATA];
+}shm_ring_slot_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t slot_count;
+    // set when the server stops, clients must not wait any longer
+    _Atomic uint32_t shutdown;
+    // next position a client reserves
+    _Atomic uint64_t head __attribute__((aligned(64)));
+    // next position the server handles
+    _Atomic uint64_t tail __attribute__((aligned(64)));
+    // futex word the server sleeps on, bumped by every publish
+    _Atomic uint32_t doorbell __attribute__((aligned(64)));
+    _Atomic uint32_t server_waiting;
+    // futex word clients sleep on while the ring is full, bumped by every release
+    _Atomic uint32_t room __attribute__((aligned(64)));
+    _Atomic uint32_t room_waiting;
+    shm_ring_slot_t slots[] __attribute__((aligned(64)));
+}shm_ring_t;
+
+/*
+*   The server's handle on a ring it created. Clients can write anything
+*   in the mapping, so the server indexes and unmaps it with its own copy
+*   of slot_count.
+*/
+typedef struct
+{
+    shm_ring_t *shared;
+    uint32_t slot_count;
+    // when the slot at tail was first seen held by a client, reserved
+    // but not published or answered but not released
+    uint64_t held_since_ns;
+}shm_ring_server_t;
+
+// server side
+shm_ring_server_t *shm_ring_create(const char *name, uint32_t slot_count);
+shm_ring_slot_t *shm_ring_next(shm_ring_server_t *server);
+void shm_ring_complete(shm_ring_server_t *server, shm_ring_slot_t *slot);
+void shm_ring_stop(shm_ring_server_t *server);
+void shm_ring_destroy(shm_ring_server_t *server, const char *name);
+
+// client side
+shm_ring_t *shm_ring_attach(const char *name);
+int shm_ring_request(shm_ring_t *ring, const char *buf, size_t len,
+                        int64_t *resp_offset, int64_t *resp_end);
+void shm_ring_detach(shm_ring_t *ring);
+
+#endif /* SHM_RING_H */
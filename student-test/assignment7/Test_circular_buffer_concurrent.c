@@ -0,0 +1,233 @@
+#include "unity.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+/**
+* Userspace model of the lockless aesdchar read path: one writer adds entries
+* inside a sequence count write section, readers copy without any lock and
+* retry when the count changed. Overwritten entries are only freed once every
+* reader is done, which stands in for the RCU grace period of the driver.
+*/
+
+#define MODEL_READERS       (4)
+#define MODEL_WRITES        (200000)
+#define MODEL_MAX_LINE      (64)
+#define MODEL_SNAPSHOT_LEN  (AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * MODEL_MAX_LINE)
+
+struct model
+{
+    struct aesd_circular_buffer buffer;
+    unsigned int seq;
+    bool done;
+    // overwritten entries, freed after the readers join
+    char *retired[MODEL_WRITES];
+    size_t retired_count;
+};
+
+struct model_snapshot
+{
+    struct model *model;
+    unsigned int seq;
+    char *dest;
+};
+
+struct model_reader
+{
+    struct model *model;
+    unsigned long snapshots;
+    unsigned long retries;
+    bool consistent;
+};
+
+static unsigned int model_read_begin(struct model *model)
+{
+    unsigned int seq;
+
+    while((seq = __atomic_load_n(&model->seq, __ATOMIC_ACQUIRE)) & 1)
+    {
+        // a write is in progress
+    }
+    return seq;
+}
+
+static bool model_read_retry(struct model *model, unsigned int seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&model->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/**
+* Writes "<n> " followed by a pattern depending on n, so a reader can tell a
+* line of one entry from a mix of two
+*/
+static size_t model_format_line(char *line, unsigned int n)
+{
+    size_t len = snprintf(line, MODEL_MAX_LINE, "%u ", n);
+    size_t pad = n % (MODEL_MAX_LINE - 16);
+
+    memset(line + len, 'a' + (n % 26), pad);
+    len += pad;
+    line[len++] = '\n';
+    return len;
+}
+
+static void *model_writer(void *arg)
+{
+    struct model *model = arg;
+    struct aesd_buffer_entry entry;
+    const char *evicted;
+    char *line;
+    unsigned int n;
+
+    for(n = 0; n < MODEL_WRITES; n++)
+    {
+        line = malloc(MODEL_MAX_LINE);
+        entry.buffptr = line;
+        entry.size = model_format_line(line, n);
+
+        __atomic_fetch_add(&model->seq, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        evicted = aesd_circular_buffer_add_entry(&model->buffer, &entry);
+        __atomic_fetch_add(&model->seq, 1, __ATOMIC_RELEASE);
+
+        if(evicted != NULL)
+        {
+            model->retired[model->retired_count++] = (char *)evicted;
+        }
+    }
+    __atomic_store_n(&model->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static size_t model_copy(void *ctx, size_t dest_offset, const char *src, size_t bytes)
+{
+    struct model_snapshot *snap = ctx;
+
+    // same check as the driver, entry fields are stale once a write started
+    if(model_read_retry(snap->model, snap->seq))
+    {
+        return 0;
+    }
+    memcpy(snap->dest + dest_offset, src, bytes);
+    return bytes;
+}
+
+/**
+* A snapshot must be whole lines with consecutive sequence numbers
+*/
+static bool model_check_snapshot(const char *data, size_t len)
+{
+    char expected[MODEL_MAX_LINE];
+    size_t offset = 0;
+    size_t line_len;
+    unsigned int n;
+
+    if(len == 0)
+    {
+        return true;
+    }
+    if(sscanf(data, "%u ", &n) != 1)
+    {
+        return false;
+    }
+
+    while(offset < len)
+    {
+        line_len = model_format_line(expected, n++);
+        if(((len - offset) < line_len) || (memcmp(data + offset, expected, line_len) != 0))
+        {
+            return false;
+        }
+        offset += line_len;
+    }
+    return true;
+}
+
+static void *model_reader(void *arg)
+{
+    struct model_reader *reader = arg;
+    struct model_snapshot snap = { .model = reader->model };
+    char *dest = malloc(MODEL_SNAPSHOT_LEN);
+    struct aesd_buffer_entry *entry;
+    size_t entry_offset;
+    uint32_t index;
+    size_t copied;
+
+    snap.dest = dest;
+    reader->consistent = true;
+    while(!__atomic_load_n(&reader->model->done, __ATOMIC_ACQUIRE))
+    {
+        copied = 0;
+        snap.seq = model_read_begin(reader->model);
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(&reader->model->buffer, 0, &entry_offset);
+        if(entry != NULL)
+        {
+            index = aesd_circular_buffer_entry_index(&reader->model->buffer, entry);
+            copied = aesd_circular_buffer_copy_from(&reader->model->buffer, &index, &entry_offset,
+                                                    MODEL_SNAPSHOT_LEN, model_copy, &snap);
+        }
+        if(model_read_retry(reader->model, snap.seq))
+        {
+            reader->retries++;
+            continue;
+        }
+
+        reader->snapshots++;
+        if(!model_check_snapshot(dest, copied))
+        {
+            reader->consistent = false;
+            break;
+        }
+    }
+    free(dest);
+    return NULL;
+}
+
+/**
+* Readers racing a writer that keeps overwriting entries only ever accept
+* snapshots made of whole, consecutive entries
+*/
+void test_lockless_read_consistent_under_overwrite()
+{
+    struct model *model = calloc(1, sizeof(struct model));
+    struct model_reader readers[MODEL_READERS];
+    pthread_t reader_threads[MODEL_READERS];
+    pthread_t writer_thread;
+    struct aesd_buffer_entry *entry;
+    uint32_t index;
+    size_t i;
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(model, "Could not allocate the model");
+    aesd_circular_buffer_init(&model->buffer);
+
+    for(i = 0; i < MODEL_READERS; i++)
+    {
+        memset(&readers[i], 0, sizeof(readers[i]));
+        readers[i].model = model;
+        pthread_create(&reader_threads[i], NULL, model_reader, &readers[i]);
+    }
+    pthread_create(&writer_thread, NULL, model_writer, model);
+
+    pthread_join(writer_thread, NULL);
+    for(i = 0; i < MODEL_READERS; i++)
+    {
+        pthread_join(reader_threads[i], NULL);
+        TEST_ASSERT_TRUE_MESSAGE(readers[i].consistent, "A reader accepted a torn snapshot");
+    }
+
+    // no reader is left, overwritten entries can go
+    for(i = 0; i < model->retired_count; i++)
+    {
+        free(model->retired[i]);
+    }
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, &model->buffer, index)
+    {
+        free((char *)entry->buffptr);
+    }
+    aesd_circular_buffer_free(&model->buffer);
+    free(model);
+}
@@ -0,0 +1,193 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+static char entries[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 2][16];
+
+/**
+* Adds "write<n>\n" entries numbered from @param first to @param last to @param buffer,
+* each with timestamp 10 * n
+*/
+static void write_entries(struct aesd_circular_buffer *buffer, int first, int last)
+{
+    struct aesd_buffer_entry entry;
+    int i;
+
+    for(i = first; i <= last; i++)
+    {
+        snprintf(entries[i], sizeof(entries[i]), "write%d\n", i);
+        entry.buffptr = entries[i];
+        entry.size = strlen(entries[i]);
+        entry.timestamp = (uint64_t)i * 10;
+        aesd_circular_buffer_add_entry(buffer, &entry);
+    }
+}
+
+/**
+* Copies within one entry and across consecutive entries return the concatenated bytes
+*/
+void test_copy_range_across_entries()
+{
+    struct aesd_circular_buffer buffer;
+    char dest[128];
+    size_t copied;
+
+    aesd_circular_buffer_init(&buffer);
+    write_entries(&buffer, 0, 3);
+
+    memset(dest, 0, sizeof(dest));
+    copied = aesd_circular_buffer_copy_range(&buffer, 1, dest, 4);
+    TEST_ASSERT_EQUAL_MESSAGE(4, copied, "Copy within one entry returned the wrong byte count");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("rite", dest, "Copy within one entry returned the wrong bytes");
+
+    memset(dest, 0, sizeof(dest));
+    copied = aesd_circular_buffer_copy_range(&buffer, 5, dest, 11);
+    TEST_ASSERT_EQUAL_MESSAGE(11, copied, "Copy across entries returned the wrong byte count");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("0\nwrite1\nwr", dest, "Copy across entries returned the wrong bytes");
+}
+
+/**
+* A copy larger than the buffer stops at its last byte, a copy past the end copies nothing
+*/
+void test_copy_range_stops_at_end()
+{
+    struct aesd_circular_buffer buffer;
+    char dest[128];
+    size_t copied;
+
+    aesd_circular_buffer_init(&buffer);
+    write_entries(&buffer, 0, 3);
+
+    memset(dest, 0, sizeof(dest));
+    copied = aesd_circular_buffer_copy_range(&buffer, 0, dest, sizeof(dest));
+    TEST_ASSERT_EQUAL_MESSAGE(28, copied, "Whole buffer copy returned the wrong byte count");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("write0\nwrite1\nwrite2\nwrite3\n", dest,
+                                     "Whole buffer copy returned the wrong bytes");
+
+    copied = aesd_circular_buffer_copy_range(&buffer, 28, dest, sizeof(dest));
+    TEST_ASSERT_EQUAL_MESSAGE(0, copied, "Copy past the end of the buffer returned data");
+}
+
+/**
+* Offsets are counted from the oldest entry still stored once the buffer has wrapped
+*/
+void test_copy_range_after_wrap()
+{
+    struct aesd_circular_buffer buffer;
+    char dest[128];
+    size_t copied;
+
+    aesd_circular_buffer_init(&buffer);
+    write_entries(&buffer, 0, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 1);
+
+    memset(dest, 0, sizeof(dest));
+    copied = aesd_circular_buffer_copy_range(&buffer, 0, dest, 14);
+    TEST_ASSERT_EQUAL_MESSAGE(14, copied, "Copy after wrap returned the wrong byte count");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("write2\nwrite3\n", dest, "Copy after wrap did not start at the oldest entry");
+}
+
+static size_t copy_to_dest(void *ctx, size_t dest_offset, const char *src, size_t bytes)
+{
+    memcpy((char *)ctx + dest_offset, src, bytes);
+    return bytes;
+}
+
+/**
+* aesd_circular_buffer_copy_from() leaves its position at the first byte not copied,
+* moving to the start of the next entry once an entry is copied to its end
+*/
+void test_copy_from_advances_position()
+{
+    struct aesd_circular_buffer buffer;
+    char dest[128];
+    uint32_t index;
+    size_t entry_offset = 5;
+    size_t copied;
+
+    aesd_circular_buffer_init(&buffer);
+    write_entries(&buffer, 0, 3);
+    index = buffer.out_offs;
+
+    memset(dest, 0, sizeof(dest));
+    copied = aesd_circular_buffer_copy_from(&buffer, &index, &entry_offset, 2, copy_to_dest, dest);
+    TEST_ASSERT_EQUAL_MESSAGE(2, copied, "Copy to the end of an entry returned the wrong byte count");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("0\n", dest, "Copy to the end of an entry returned the wrong bytes");
+    TEST_ASSERT_EQUAL_MESSAGE(buffer.out_offs + 1, index, "Position did not move to the next entry");
+    TEST_ASSERT_EQUAL_MESSAGE(0, entry_offset, "Position did not move to the start of the next entry");
+
+    memset(dest, 0, sizeof(dest));
+    copied = aesd_circular_buffer_copy_from(&buffer, &index, &entry_offset, 3, copy_to_dest, dest);
+    TEST_ASSERT_EQUAL_MESSAGE(3, copied, "Copy from the saved position returned the wrong byte count");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("wri", dest, "Copy from the saved position returned the wrong bytes");
+    TEST_ASSERT_EQUAL_MESSAGE(3, entry_offset, "Position did not stop inside the entry");
+}
+
+/**
+* aesd_circular_buffer_remove_oldest() hands back entries oldest first, keeping the byte
+* count and offsets of the entries left, and returns NULL once the buffer is empty
+*/
+void test_remove_oldest_keeps_offsets()
+{
+    struct aesd_circular_buffer buffer;
+    char dest[128];
+    size_t copied;
+    int i;
+
+    aesd_circular_buffer_init(&buffer);
+    write_entries(&buffer, 0, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(entries[1], aesd_circular_buffer_remove_oldest(&buffer),
+                                  "Removing from a full buffer did not return its oldest entry");
+    TEST_ASSERT_EQUAL_MESSAGE(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - 1, aesd_circular_buffer_count(&buffer),
+                              "Removing an entry did not lower the entry count");
+    TEST_ASSERT_EQUAL_MESSAGE((8 * 7) + 8, aesd_circular_buffer_size(&buffer),
+                              "Removing an entry did not lower the byte count");
+
+    memset(dest, 0, sizeof(dest));
+    copied = aesd_circular_buffer_copy_range(&buffer, 0, dest, 7);
+    TEST_ASSERT_EQUAL_MESSAGE(7, copied, "Copy after removing an entry returned the wrong byte count");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("write2\n", dest, "Copy after removing an entry did not start at the next oldest");
+
+    write_entries(&buffer, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 1, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 1);
+    TEST_ASSERT_EQUAL_MESSAGE(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, aesd_circular_buffer_count(&buffer),
+                              "Adding to a buffer with a free slot dropped an entry");
+
+    for(i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++)
+    {
+        TEST_ASSERT_NOT_NULL_MESSAGE(aesd_circular_buffer_remove_oldest(&buffer), "Removing from a non empty buffer returned NULL");
+    }
+    TEST_ASSERT_NULL_MESSAGE(aesd_circular_buffer_remove_oldest(&buffer), "Removing from an empty buffer did not return NULL");
+    TEST_ASSERT_EQUAL_MESSAGE(0, aesd_circular_buffer_size(&buffer), "An emptied buffer still holds bytes");
+}
+
+/**
+* aesd_circular_buffer_find_entry_for_time() counts the entries before the first one at or
+* after a time, from the oldest entry left after a wrap, and returns the count past the newest
+*/
+void test_find_entry_for_time_after_wrap()
+{
+    struct aesd_circular_buffer buffer;
+
+    aesd_circular_buffer_init(&buffer);
+    TEST_ASSERT_EQUAL_MESSAGE(0, aesd_circular_buffer_find_entry_for_time(&buffer, 0),
+                              "Search of an empty buffer did not return 0");
+
+    write_entries(&buffer, 0, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+
+    TEST_ASSERT_EQUAL_MESSAGE(0, aesd_circular_buffer_find_entry_for_time(&buffer, 0),
+                              "A time before the oldest entry did not find the oldest entry");
+    TEST_ASSERT_EQUAL_MESSAGE(0, aesd_circular_buffer_find_entry_for_time(&buffer, 10),
+                              "The time of the oldest entry did not find it");
+    TEST_ASSERT_EQUAL_MESSAGE(1, aesd_circular_buffer_find_entry_for_time(&buffer, 11),
+                              "A time just after the oldest entry did not find the next one");
+    TEST_ASSERT_EQUAL_MESSAGE(4, aesd_circular_buffer_find_entry_for_time(&buffer, 50),
+                              "The time of an entry did not find it");
+    TEST_ASSERT_EQUAL_MESSAGE(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - 1,
+                              aesd_circular_buffer_find_entry_for_time(&buffer, 100),
+                              "The time of the newest entry did not find it");
+    TEST_ASSERT_EQUAL_MESSAGE(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED,
+                              aesd_circular_buffer_find_entry_for_time(&buffer, 101),
+                              "A time after the newest entry did not return the entry count");
+}